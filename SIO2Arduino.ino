@@ -24,9 +24,40 @@
 #include <SdFat.h>
 #include "atari.h"
 #include "sio_channel.h"
+#include "disk_device.h"
+#include "sdrive.h"
 #include "disk_drive.h"
+#include "task_scheduler.h"
+#ifdef SIO_SNIFFER
+#include "sio_sniffer.h"
+#endif
+#ifdef MEMORY_PROBE
+#include "memory_probe.h"
+#endif
+#ifdef SESSION_RESTORE
+#include "session_store.h"
+#endif
+#ifdef PRINTER_SPOOL
+#include "printer_device.h"
+#endif
+#ifdef RS232_DEVICE
+#include "rs232_device.h"
+#endif
+#ifdef HOST_IMAGES
+#include "host_drive.h"
+#endif
+#ifdef DISK_SETS
+#include "disk_set.h"
+#endif
+#ifdef SETTINGS_FILE
+#include "settings.h"
+#endif
+#ifdef IMAGE_COPY
+#include "image_copier.h"
+#endif
 #ifdef LCD_DISPLAY
 #include <LiquidCrystal.h>
+#include "lcd_display.h"
 #endif
 
 /**
@@ -39,27 +70,84 @@ boolean format(int deviceId, int density);
 int getFileList(int startIndex, int count, FileEntry *entries);
 void mountFileIndex(int deviceId, int ix);
 void changeDirectory(int ix);
+boolean continueFormat();
+boolean continueLoad();
+#ifdef SELECTOR_BUTTON
+boolean scanForDisk();
+#endif
+#ifdef LCD_DISPLAY
+boolean updateDisplay();
+#endif
+#ifdef PRINTER_SPOOL
+boolean spoolPrinter();
+#endif
+#ifdef SECTOR_CACHE
+boolean writeBackCache();
+boolean readAheadCache();
+#endif
+#ifdef IMAGE_COPY
+boolean copyImage();
+#endif
 
 /**
  * Global variables
  */
 DriveAccess driveAccess(getDeviceStatus, readSector, writeSector, format);
 DriveControl driveControl(getFileList, mountFileIndex, changeDirectory);
-SIOChannel sioChannel(PIN_ATARI_CMD, &SIO_UART, &driveAccess, &driveControl);
+DiskDevice diskDevice(DEVICE_D1, &driveAccess);
+SDriveHandler sdriveHandler(&driveControl);
+#ifdef PRINTER_SPOOL
+#ifdef PRINTER_ASCII
+PrinterDevice printerDevice(true);
+#else
+PrinterDevice printerDevice(false);
+#endif
+#endif
+#ifdef RS232_DEVICE
+RS232Device rs232Device(&SIO_UART, &RS232_UART);
+#endif
+#ifdef SIO_STATS
+SIOStats sioStats;
+#endif
+#ifdef SIO_SNIFFER
+SIOSniffer sioSniffer(&SIO_UART, PIN_ATARI_CMD);
+SIOChannel sioChannel(PIN_ATARI_CMD, &sioSniffer);
+#else
+SIOChannel sioChannel(PIN_ATARI_CMD, &SIO_UART);
+#endif
+TaskScheduler scheduler(&sioChannel);
 SdFat32 card;
 SdFile currDir;
 SdFile file; // TODO: make this unnecessary
 DiskDrive drive1;
+#ifdef HOST_IMAGES
+HostDrive hostDrive(&HOST_UART);
+#endif
+#ifdef DISK_SETS
+DiskSet diskSet;
+#endif
+#ifdef IMAGE_COPY
+ImageCopier imageCopier(&currDir);
+#endif
+#ifdef MEMORY_PROBE
+MemoryProbe memoryProbe;
+#endif
+#ifdef SESSION_RESTORE
+SessionStore sessionStore;
+Session session;
+#endif
 #ifdef SELECTOR_BUTTON
 boolean isSwitchPressed = false;
 unsigned long lastSelectionPress;
 boolean isFileOpened=false;
+boolean diskScanWrapped;
 #endif
 #ifdef RESET_BUTTON
 unsigned long lastResetPress;
 #endif
 #ifdef LCD_DISPLAY
 LiquidCrystal lcd(PIN_LCD_RD,PIN_LCD_ENABLE,PIN_LCD_DB4,PIN_LCD_DB5,PIN_LCD_DB6,PIN_LCD_DB7);
+LCDDisplay lcdDisplay(&lcd);
 #endif
 
 void setup() {
@@ -77,7 +165,28 @@ void setup() {
   #endif
 
   // initialize serial port to Atari
-  SIO_UART.begin(19200);
+  SIO_UART.begin(SIO_BAUD_RATE);
+
+  // register the emulated devices with the SIO channel
+  #ifdef SIO_STATS
+  sioChannel.setStats(&sioStats);
+  #endif
+  #ifdef MEMORY_PROBE
+  sioChannel.setMemoryProbe(&memoryProbe);
+  sdriveHandler.setMemoryProbe(&memoryProbe);
+  #endif
+  #ifdef IMAGE_COPY
+  sdriveHandler.setImageCopier(&imageCopier);
+  #endif
+  sioChannel.addDevice(&diskDevice);
+  sioChannel.addDevice(&sdriveHandler);
+  #ifdef PRINTER_SPOOL
+  sioChannel.addDevice(&printerDevice);
+  #endif
+  #ifdef RS232_DEVICE
+  rs232Device.begin();
+  sioChannel.addDevice(&rs232Device);
+  #endif
 
   // set pin modes
   #ifdef SELECTOR_BUTTON
@@ -89,37 +198,67 @@ void setup() {
 
   #ifdef LCD_DISPLAY
   // set up LCD if appropriate
-  lcd.begin(16, 2);
-  lcd.print(F("SIO2Arduino"));
-  lcd.setCursor(0,1);
+  lcdDisplay.begin();
+  lcdDisplay.setLine(0, F("SIO2Arduino"));
+  lcdDisplay.flush();
+  scheduler.schedule(updateDisplay);
   #endif
 
   // initialize SD card
   LOG_MSG(F("Initializing SD card..."));
   pinMode(PIN_SD_CS, OUTPUT);
 
-  if (!card.begin(PIN_SD_CS, SD_SCK_MHZ(50))) {
+  if (!card.begin(PIN_SD_CS, SD_SCK_MHZ(SD_SPI_MHZ))) {
     LOG_MSG_CR(F(" failed."));
     #ifdef LCD_DISPLAY
-      lcd.print(F("SD Init Error"));
+      lcdDisplay.setLine(1, F("SD Init Error"));
+      lcdDisplay.flush();
     #endif     
     return;
   }
   
+  #ifdef SETTINGS_FILE
+  // (the settings may change how the card itself is driven, so they come first)
+  applySettings();
+  #endif
+
   if (!currDir.open("/")) {
     LOG_MSG_CR(F(" failed."));
     #ifdef LCD_DISPLAY
-      lcd.print(F("SD Root Error"));
+      lcdDisplay.setLine(1, F("SD Root Error"));
+      lcdDisplay.flush();
     #endif     
     return;
   }
 
   LOG_MSG_CR(F(" done."));
+  #ifdef SIO_SNIFFER
+  if (!sioSniffer.begin()) {
+    LOG_MSG_CR(F("Unable to open trace file"));
+  }
+  #endif
   #ifdef LCD_DISPLAY
-    lcd.print(F("READY"));
-    delay(3000);
+    lcdDisplay.setLine(1, F("READY"));
+    lcdDisplay.flush();
   #endif
+  #ifdef SESSION_RESTORE
+  // go straight back to the image that was mounted before power was lost
+  if (!restoreSession()) {
+    mountFilename(0, "AUTORUN.ATR");
+  }
+  #else
   mountFilename(0, "AUTORUN.ATR");
+  #endif
+
+  #ifdef HOST_IMAGES
+  // a host serving an image takes D1: over from the card
+  HOST_UART.begin(HOST_BAUD_RATE);
+  hostDrive.begin();
+  #endif
+
+  #ifdef MEMORY_PROBE
+  reportMemory();
+  #endif
 }
 
 void loop() {
@@ -133,6 +272,43 @@ void loop() {
     changeDisk(0);
   } else isSwitchPressed=(digitalRead(PIN_SELECTOR) == LOW);
   #endif
+  #ifdef SIO_SNIFFER
+  // write recorded bus traffic out to the card
+  sioSniffer.service();
+  #endif
+  #ifdef HOST_IMAGES
+  // take in host replies and prefetch the next sector between commands
+  hostDrive.service(sioChannel.isIdle());
+  #endif
+  #ifdef RS232_DEVICE
+  // finish sending anything left over from concurrent mode
+  rs232Device.service();
+  #endif
+  #ifdef PRINTER_SPOOL
+  // get printed output out to the card
+  if (printerDevice.isPending()) {
+    scheduler.schedule(spoolPrinter);
+  }
+  #endif
+  #ifdef SECTOR_CACHE
+  // get written sectors out to the card once the Atari is done writing
+  if (drive1.hasDirtySectors()) {
+    scheduler.schedule(writeBackCache);
+  }
+  // and read the sectors it's about to ask for
+  if (drive1.hasReadAhead()) {
+    scheduler.schedule(readAheadCache);
+  }
+  #endif
+  #ifdef IMAGE_COPY
+  // copy images a block at a time between commands
+  if (imageCopier.isBusy()) {
+    scheduler.schedule(copyImage);
+  }
+  #endif
+
+  // give the background jobs a slice each (only while the bus is idle)
+  scheduler.run();
   #ifdef RESET_BUTTON
   // watch the reset button
   if (digitalRead(PIN_RESET) == LOW && millis() - lastResetPress > 250) {
@@ -147,29 +323,188 @@ void loop() {
   #endif
 }
 
+#ifdef SESSION_RESTORE
+/**
+ * Reopens the directory and image recorded in the last session. Everything is opened by
+ * directory entry index, so this costs one directory entry read per level instead of a
+ * search.
+ */
+boolean restoreSession() {
+  SdFile subDir;
+  DirFat_t dir;
+  char name[13];
+
+  memset(&session, 0, sizeof(session));
+  if (!sessionStore.load(&session)) {
+    return false;
+  }
+
+  for (byte i=0; i < session.depth; i++) {
+    if (!subDir.open(&currDir, session.dirPath[i], O_READ) || !subDir.isDir()) {
+      changeDirectory(-1);
+      return false;
+    }
+    currDir = subDir;
+  }
+
+  // (the 8.3 name is compared since that's what a mount by name uses)
+  if (openImageIndex(session.fileIndex) && file.dirEntry(&dir)) {
+    createFilename(name, (char*)dir.name);
+  } else {
+    name[0] = '\0';
+  }
+  if (strcmp(name, session.name)) {
+    LOG_MSG_CR(F("Last session not found"));
+    file.close();
+    changeDirectory(-1);
+    return false;
+  }
+
+  return mountOpenedFile(0, name);
+}
+#endif
+
+#ifdef SETTINGS_FILE
+/**
+ * Applies the tuning in the settings file, if there is one.
+ */
+void applySettings() {
+  SettingsFile settingsFile;
+  Settings settings;
+
+  if (!settingsFile.load(&settings)) {
+    return;
+  }
+  LOG_MSG_CR(F(" settings loaded,"));
+
+  if (settings.sioBaudRate != SIO_BAUD_RATE) {
+    SIO_UART.begin(settings.sioBaudRate);
+    sioChannel.getTiming()->setBaudRate(settings.sioBaudRate);
+  }
+  #ifdef RS232_DEVICE
+  rs232Device.setSioBaudRate(settings.sioBaudRate);
+  #endif
+  sioChannel.getTiming()->setProfile(settings.timingProfile);
+  #ifdef SECTOR_CACHE
+  drive1.setCacheTuning(settings.readAhead, settings.writeBackDelay);
+  #endif
+
+  // (a card that won't start at the new clock goes back to the old one)
+  if (settings.spiMHz != SD_SPI_MHZ && !card.begin(PIN_SD_CS, SD_SCK_MHZ(settings.spiMHz))) {
+    LOG_MSG(F(" SD card won't start at that clock,"));
+    card.begin(PIN_SD_CS, SD_SCK_MHZ(SD_SPI_MHZ));
+  }
+}
+#endif
+
+#ifdef MEMORY_PROBE
+/**
+ * Logs the static RAM taken by each subsystem and the headroom left after startup.
+ */
+void reportMemory() {
+  memoryProbe.sample(NULL);
+
+  LOG_MSG(F("SD card: "));
+  LOG_MSG(sizeof(card) + sizeof(currDir) + sizeof(file));
+  LOG_MSG(F(", drive: "));
+  LOG_MSG(sizeof(drive1));
+  LOG_MSG(F(", SIO channel: "));
+  LOG_MSG(sizeof(sioChannel));
+  LOG_MSG(F(", devices: "));
+  LOG_MSG_CR(sizeof(driveAccess) + sizeof(driveControl) + sizeof(diskDevice) + sizeof(sdriveHandler));
+  #ifdef SIO_STATS
+  LOG_MSG(F("Stats: "));
+  LOG_MSG_CR(sizeof(sioStats));
+  #endif
+  #ifdef SIO_SNIFFER
+  LOG_MSG(F("Sniffer: "));
+  LOG_MSG_CR(sizeof(sioSniffer));
+  #endif
+  #ifdef LCD_DISPLAY
+  LOG_MSG(F("LCD: "));
+  LOG_MSG_CR(sizeof(lcd) + sizeof(lcdDisplay));
+  #endif
+  #ifdef PRINTER_SPOOL
+  LOG_MSG(F("Printer: "));
+  LOG_MSG_CR(sizeof(printerDevice));
+  #endif
+  #ifdef RS232_DEVICE
+  LOG_MSG(F("RS232: "));
+  LOG_MSG_CR(sizeof(rs232Device));
+  #endif
+  #ifdef DISK_SETS
+  LOG_MSG(F("Disk set: "));
+  LOG_MSG_CR(sizeof(diskSet));
+  #endif
+  #ifdef IMAGE_COPY
+  LOG_MSG(F("Image copier: "));
+  LOG_MSG_CR(sizeof(imageCopier));
+  #endif
+
+  memoryProbe.dump();
+}
+#endif
+
 void SIO_CALLBACK() {
   // inform the SIO channel that an incoming byte is available
   sioChannel.processIncomingByte();
 }
 
 DriveStatus* getDeviceStatus(int deviceId) {
+  #ifdef HOST_IMAGES
+  if (hostDrive.hasImage()) {
+    return hostDrive.getStatus();
+  }
+  #endif
   return drive1.getStatus();
 }
 
 SectorDataInfo* readSector(int deviceId, unsigned long sector, byte *data) {
+  #ifdef HOST_IMAGES
+  if (hostDrive.hasImage()) {
+    SectorDataInfo* info = hostDrive.getSectorData(sector, data);
+    #ifdef LCD_DISPLAY
+    if (info != NULL) {
+      lcdDisplay.recordAccess(sector, info->length, false);
+    }
+    #endif
+    return info;
+  }
+  #endif
   if (drive1.hasImage()) {
-    return drive1.getSectorData(sector, data);
+    SectorDataInfo* info = drive1.getSectorData(sector, data);
+    #ifdef LCD_DISPLAY
+    if (info != NULL) {
+      lcdDisplay.recordAccess(sector, info->length, false);
+    }
+    #endif
+    return info;
   } else {
     return NULL;
   }
 }
 
 boolean writeSector(int deviceId, unsigned long sector, byte* data, unsigned long length) {
+  #ifdef LCD_DISPLAY
+  lcdDisplay.recordAccess(sector, length, true);
+  #endif
+  #ifdef HOST_IMAGES
+  if (hostDrive.hasImage()) {
+    return (hostDrive.writeSectorData(sector, data, length) == length);
+  }
+  #endif
   return (drive1.writeSectorData(sector, data, length) == length);
 }
 
 boolean format(int deviceId, int density) {
   char name[13];
+
+  #ifdef HOST_IMAGES
+  // (host images can't be formatted from the Atari)
+  if (hostDrive.hasImage()) {
+    return false;
+  }
+  #endif
   
   // get current filename
   file.getName(name, 13);
@@ -189,36 +524,140 @@ boolean format(int deviceId, int density) {
 
   // allow the virtual drive to format the image (and possibly alter its size)
   if (drive1.formatImage(&file, density)) {
-    // set the new image file for the drive
-    drive1.setImageFile(&file);
+    // the drive reads unfilled sectors as zeros, so the fill can happen in the background
+    if (!scheduler.schedule(continueFormat)) {
+      while (!drive1.continueFormat());
+    }
     return true;
   } else {
     return false;
   }  
 }
 
+#ifdef SELECTOR_BUTTON
 void changeDisk(int deviceId) {
+  #ifdef DISK_SETS
+  // within a disk set, the button goes straight to the next disk
+  if (diskSet.getCurrent() + 1 < diskSet.getCount()) {
+    mountSetDisk(diskSet.getCurrent() + 1);
+    return;
+  }
+  #endif
+
+  // a big directory can take a while to get through, so the search runs in the background
+  diskScanWrapped = false;
+  scheduler.schedule(scanForDisk);
+}
+
+/**
+ * Background task that mounts the next image in the current directory, one directory
+ * entry per slice. Indexing the image it finds is left to the continueLoad task.
+ */
+boolean scanForDisk() {
   DirFat_t dir;
   char name[13];
-  boolean imageChanged = false;
-
-  while (!imageChanged) {
-    // get next dir entry
-    int8_t result = currDir.readDir((DirFat_t*)&dir);
-    
-    // if we got back a 0, rewind the directory and get the first dir entry
-    if (!result) {
-      currDir.rewind();
-      result = currDir.readDir((DirFat_t*)&dir);
-    }
-    
-    // if we have a valid file response code, open it
-    if (result > 0 && isValidFilename((char*)&dir.name)) {
-      createFilename(name, (char*)dir.name);
-      imageChanged = mountFilename(deviceId, name);
+
+  // a format still filling in the mounted image has to finish before its file is
+  // closed, so that goes first (a chunk per slice)
+  if (!drive1.continueFormat()) {
+    return false;
+  }
+
+  // get next dir entry
+  int8_t result = currDir.readDir((DirFat_t*)&dir);
+
+  // if we got back a 0, rewind the directory (unless we've already been all the way round)
+  if (!result) {
+    if (diskScanWrapped) {
+      return true;
     }
+    diskScanWrapped = true;
+    currDir.rewind();
+    return false;
+  }
+
+  // if we have a valid file response code, open it
+  if (result > 0 && isValidFilename((char*)&dir.name)) {
+    createFilename(name, (char*)dir.name);
+    return mountFilename(0, name);
+  }
+
+  return (result < 0);
+}
+#endif
+
+/**
+ * Background task that zero-fills a newly formatted image.
+ */
+boolean continueFormat() {
+  return drive1.continueFormat();
+}
+
+/**
+ * Background task that indexes a newly mounted image a few blocks at a time.
+ */
+boolean continueLoad() {
+  if (!drive1.continueLoad()) {
+    return false;
+  }
+  #ifdef LCD_DISPLAY
+  // (an image that turned out to be invalid has been unmounted)
+  if (!drive1.hasImage()) {
+    lcdDisplay.setLine(1, F("Invalid image"));
+  }
+  #endif
+  return true;
+}
+
+#ifdef LCD_DISPLAY
+/**
+ * Background task that catches the LCD up with its shadow copy (it never finishes).
+ */
+boolean updateDisplay() {
+  lcdDisplay.update();
+  return false;
+}
+#endif
+
+#ifdef PRINTER_SPOOL
+/**
+ * Background task that moves buffered printer output to the card.
+ */
+boolean spoolPrinter() {
+  return printerDevice.spool();
+}
+#endif
+
+#ifdef SECTOR_CACHE
+/**
+ * Background task that writes sectors changed in the cache to the image.
+ */
+boolean writeBackCache() {
+  return drive1.writeBackCache();
+}
+
+/**
+ * Background task that reads upcoming sectors into the cache.
+ */
+boolean readAheadCache() {
+  return drive1.readAheadCache();
+}
+#endif
+
+#ifdef IMAGE_COPY
+/**
+ * Background task that copies an image a block at a time.
+ */
+boolean copyImage() {
+  #ifdef SECTOR_CACHE
+  // (the copy has to see what the Atari wrote to the mounted image before asking for it)
+  if (imageCopier.isStarting()) {
+    drive1.flushCache();
   }
+  #endif
+  return imageCopier.run();
 }
+#endif
 
 boolean isValidFilename(char *s) {
   return (  s[0] != '.' &&    // ignore hidden files 
@@ -231,9 +670,18 @@ boolean isValidFilename(char *s) {
 #ifdef ATX_IMAGES              
           || (s[8] == 'A' && s[9] == 'T' && s[10] == 'X')
 #endif              
+#ifdef DCM_IMAGES
+          || (s[8] == 'D' && s[9] == 'C' && s[10] == 'M')
+#endif
 #ifdef XEX_IMAGES
           || (s[8] == 'X' && s[9] == 'E' && s[10] == 'X')
 #endif              
+#ifdef VDOS_IMAGES
+          || (s[8] == 'D' && s[9] == 'O' && s[10] == 'S')
+#endif
+#ifdef DISK_SETS
+          || (s[8] == 'S' && s[9] == 'E' && s[10] == 'T')
+#endif
           )
         );
 }
@@ -274,7 +722,8 @@ int getFileList(int startIndex, int count, FileEntry *entries) {
     if (isValidFilename((char*)&dir.name) || (isSubdir(&dir) && dir.name[0] != '.')) {
       if (currentEntry >= startIndex) {
         memcpy(entries[ix].name, dir.name, 11);
-        if (isSubdir(&dir)) {
+        // (directories mounted as virtual DOS disks are listed as images)
+        if (isSubdir(&dir) && !isValidFilename((char*)&dir.name)) {
           entries[ix].isDirectory = true;
         } else {
           entries[ix].isDirectory = false;
@@ -303,10 +752,21 @@ void changeDirectory(int ix) {
     createFilename(name, entries[0].name);
     if (subDir.open(&currDir, name, O_READ)) {
       currDir = subDir;
+      #ifdef SESSION_RESTORE
+      // past the deepest path that can be stored, the session is no longer saved
+      if (session.depth < SESSION_MAX_DEPTH) {
+        session.dirPath[session.depth++] = currDir.dirIndex();
+      } else {
+        session.depth = SESSION_DEPTH_UNKNOWN;
+      }
+      #endif
     }
   } else {
     if (subDir.open("/")) {
       currDir = subDir;
+      #ifdef SESSION_RESTORE
+      memset(&session, 0, sizeof(session));
+      #endif
     }
   }
 }
@@ -331,6 +791,55 @@ void mountFileIndex(int deviceId, int ix) {
   mountFilename(deviceId, name);
 }
 
+/**
+ * Open an image file from the current directory.
+ *
+ * name = the name of the file to open
+ */
+boolean openImageFile(char *name) {
+  if (file.open(&currDir, name, O_RDWR | O_SYNC)) {
+    return true;
+  }
+#ifdef VDOS_IMAGES
+  // directories can only be opened read-only
+  return (file.open(&currDir, name, O_READ) && keepDirectory());
+#else
+  return false;
+#endif
+}
+
+#ifdef VDOS_IMAGES
+/**
+ * Checks that a file which could only be opened read-only is a directory (mounted as a
+ * write-protected virtual DOS disk). Any other image that can't be written isn't mounted,
+ * rather than turning up writable and then failing every write.
+ */
+boolean keepDirectory() {
+  if (!file.isDir()) {
+    file.close();
+    return false;
+  }
+  LOG_MSG_CR(F("Mounting directory read-only"));
+  return true;
+}
+#endif
+
+#ifdef SESSION_RESTORE
+/**
+ * Open an image file from the current directory by its directory entry index.
+ */
+boolean openImageIndex(unsigned int index) {
+  if (file.open(&currDir, index, O_RDWR | O_SYNC)) {
+    return true;
+  }
+#ifdef VDOS_IMAGES
+  return (file.open(&currDir, index, O_READ) && keepDirectory());
+#else
+  return false;
+#endif
+}
+#endif
+
 /**
  * Mount a file with the given name.
  *
@@ -338,18 +847,82 @@ void mountFileIndex(int deviceId, int ix) {
  * name = the name of the file to mount
  */
 boolean mountFilename(int deviceId, char *name) {
+  // finish any format in progress before its file goes away
+  while (!drive1.continueFormat());
+  #ifdef SECTOR_CACHE
+  // (and anything the cache hasn't written yet)
+  drive1.flushCache();
+  #endif
+
+  #ifdef DISK_SETS
+  // (the mounted file may belong to a set, which closes it along with the rest)
+  diskSet.close(&file);
+  #endif
+
   // close previously open file
   if (file.isOpen()) {
     file.close();
   }
+
+  #ifdef DISK_SETS
+  // a disk set starts out on its first disk
+  if (diskSet.load(&currDir, name)) {
+    return mountSetDisk(0);
+  }
+  #endif
   
-  if (file.open(&currDir, name, O_RDWR | O_SYNC) && drive1.setImageFile(&file)) {
+  return (openImageFile(name) && mountOpenedFile(deviceId, name));
+}
+
+#ifdef DISK_SETS
+/**
+ * Swaps in a disk of the mounted set. Its file is already open, so this doesn't have to
+ * go looking through the directory.
+ *
+ * ix = the index of the disk in the set
+ */
+boolean mountSetDisk(byte ix) {
+  while (!drive1.continueFormat());
+  #ifdef SECTOR_CACHE
+  drive1.flushCache();
+  #endif
+
+  diskSet.select(&file, ix);
+  return mountOpenedFile(0, diskSet.getName(ix));
+}
+#endif
+
+/**
+ * Mount the image file that was just opened.
+ *
+ * deviceId = the drive ID
+ * name = the name of the file
+ */
+boolean mountOpenedFile(int deviceId, char *name) {
+  if (drive1.setImageFile(&file, &currDir)) {
     LOG_MSG_CR(name);
 
+    // (formats with an index are mounted once their header checks out and indexed in the
+    // background -- a sector read before then finishes the index first)
+    if (!scheduler.schedule(continueLoad)) {
+      while (!drive1.continueLoad());
+    }
+
+    #ifdef HOST_IMAGES
+    // picking an image on the card takes D1: back from the host
+    hostDrive.detach();
+    #endif
+
     #ifdef LCD_DISPLAY
-    lcd.clear();
-    lcd.print(name);
-    lcd.setCursor(0,1);
+    lcdDisplay.setLine(0, name);
+    lcdDisplay.setLine(1, "");
+    #endif
+
+    #ifdef SESSION_RESTORE
+    session.fileIndex = file.dirIndex();
+    memset(session.name, 0, sizeof(session.name));
+    strcpy(session.name, name);
+    sessionStore.save(&session);
     #endif
 
     return true;
@@ -6,11 +6,6 @@ const byte NAK      = 0x4E;
 const byte COMPLETE = 0x43;
 const byte ERR      = 0x45;
 
-const byte DELAY_T2 = 1;
-const byte DELAY_T3 = 2;
-const byte DELAY_T4 = 1;
-const byte DELAY_T5 = 1;
-
 const byte DENSITY_SD = 1;
 const byte DENSITY_ED = 2;
 const byte DENSITY_DD = 3;
@@ -57,6 +52,7 @@ struct StatusFrame {
 
 struct DriveStatus {
   unsigned long sectorSize;
+  unsigned long sectorCount;
   StatusFrame   statusFrame;
 };
 
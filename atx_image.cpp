@@ -0,0 +1,153 @@
+/*
+ * atx_image.cpp - Serves ATX images with their recorded sector status.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "atx_image.h"
+
+#ifdef ATX_IMAGES
+boolean ATXImage::isATXImage(byte* header) {
+  return (header[0] == 'A' && header[1] == 'T' && header[2] == '8' && header[3] == 'X');
+}
+
+/**
+ * Reads the track records and builds an index of where each sector's data lives.
+ */
+void ATXImage::load(SdFile* file) {
+  m_phantomFlip = false;
+
+  unsigned long trackRecordSize;
+  unsigned long l2;
+  unsigned long fileIndex;
+
+  // start with all sector numbers impossibly high (for a floppy disk)
+  for (int i=0; i < ATX_SECTORS; i++) {
+    m_sectorHeaders[i].sectorNumber = 60000;
+  }
+
+  // read header size
+  file->seekSet(28);
+  fileIndex = file->read() + file->read() * 256 + file->read() * 512 + file->read() * 768;
+  // skip to first track record
+  file->seekSet(fileIndex);
+
+  // NOTE: we're doing multiple file->read() statements to avoid creating any additional
+  // heap variables (we have a lot more available program space than heap space)
+
+  for (int i=0; i < 40; i++) {
+    // read track header
+    trackRecordSize = file->read();
+    trackRecordSize += file->read() * 256;
+    trackRecordSize += file->read() * 512;
+    trackRecordSize += file->read() * 768;
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    byte trackNumber = file->read();
+    file->read();
+    int sectorCount = file->read();
+    sectorCount += file->read() * 256;
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    l2 = file->read();
+    l2 += file->read() * 256;
+    l2 += file->read() * 512;
+    l2 += file->read() * 768;
+    
+    // seek to beginning of sector list
+    file->seekSet(fileIndex + l2);
+    
+    // skip sector list header
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    file->read();
+    
+    // read each sector
+    for (int i2=0; i2< sectorCount; i2++) {
+      byte sectorNum = file->read();
+      byte sectorStatus = file->read();
+      // skip sector position
+      file->read();
+      file->read();
+      // read start data pos
+      l2 = file->read();
+      l2 += file->read() * 256;
+      l2 += file->read() * 512;
+      l2 += file->read() * 768;
+      m_sectorHeaders[trackNumber * 18 + i2].sectorNumber = (trackNumber * 18) + (sectorNum - 1);
+      m_sectorHeaders[trackNumber * 18 + i2].sstatus = sectorStatus;
+      m_sectorHeaders[trackNumber * 18 + i2].fileIndex = fileIndex + l2;
+    }
+
+    // move to next track record
+    fileIndex += trackRecordSize;
+    file->seekSet(fileIndex);
+  }
+}
+
+void ATXImage::getSectorData(SdFile* file, unsigned long sector, byte* data, SectorDataInfo* info) {
+  int ix = -1;
+  for (int i=0; i < ATX_SECTORS; i++) {
+    if (m_sectorHeaders[i].sectorNumber == (sector-1)) {
+      ix = i;
+      if (!m_phantomFlip) {
+        break;
+      }
+    }
+  }
+  info->validStatusFrame = true;
+  if (ix > -1) {
+    file->seekSet(m_sectorHeaders[ix].fileIndex);
+    if (m_sectorHeaders[ix].sstatus > 0) {
+      info->error = true;
+    }
+    // hardware status bits for floppy controller are active low, so bit flip
+    *((byte*)&info->statusFrame.hardwareStatus) = ~(m_sectorHeaders[ix].sstatus);
+    *((byte*)&info->statusFrame.commandStatus) = 0x10;
+    *(&info->statusFrame.timeout_lsb) = 0xE0;
+  } else {
+    // TODO: right now we just send back a random data frame -- is this correct?
+    file->seekSet(0);
+    info->error = true;
+    // set the missing sector data bit (active low)
+    *((byte*)&info->statusFrame.hardwareStatus) = 0xF7;
+    *((byte*)&info->statusFrame.commandStatus) = 0x10;
+    *(&info->statusFrame.timeout_lsb) = 0xE0;
+  }
+  // for now, do the same global flip of duplicate sector data as PRO
+  // (alternate between first/last duplicate sectors on successive reads)
+  // TODO: this should be based on timing of sector angular position
+  m_phantomFlip = !m_phantomFlip;
+
+  readImageSector(file, data, SECTOR_SIZE_SD);
+}
+#endif
@@ -0,0 +1,30 @@
+#ifndef ATX_IMAGE_h
+#define ATX_IMAGE_h
+
+#include "image_format.h"
+
+#ifdef ATX_IMAGES
+#define ATX_SECTORS 720
+
+struct ATXSectorHeader {
+  unsigned int sectorNumber;
+  unsigned long fileIndex;
+  byte sstatus;
+};
+
+/**
+ * An ATX image: the sectors of each track as recorded from a real disk, including
+ * duplicate sectors and their FDC status.
+ */
+class ATXImage {
+public:
+  static boolean isATXImage(byte* header);
+  void load(SdFile* file);
+  void getSectorData(SdFile* file, unsigned long sector, byte* data, SectorDataInfo* info);
+private:
+  ATXSectorHeader  m_sectorHeaders[ATX_SECTORS];
+  boolean          m_phantomFlip;
+};
+#endif
+
+#endif
@@ -52,9 +52,82 @@
 // uncomment for ATX image format support (Mega 2560 only)
 //#define ATX_IMAGES
 
+// uncomment for DCM (DiskComm) image format support (Mega 2560 only)
+//#define DCM_IMAGES
+
 // uncomment for XEX "image" support
 #define XEX_IMAGES
 
+// uncomment to boot XEX files with a loader that reads 4 sectors per SIO command (using
+// the burst read command) -- files that load below $0B00 need the standard loader
+//#define XEX_BURST_LOADER
+
+// uncomment to mount SD card directories named *.DOS as virtual (read-only) DOS 2 disks (Mega 2560 only)
+//#define VDOS_IMAGES
+
+// uncomment to collect SIO latency histograms and error counters (readable with the
+// SDrive statistics command; Mega 2560 recommended)
+//#define SIO_STATS
+
+// uncomment to count reads/writes per sector of each mounted image and append them to
+// /SECTPROF.CSV when the image is unmounted (Mega 2560 only)
+//#define SECTOR_PROFILER
+
+// uncomment to record all SIO bus traffic (timestamped) to /SIOTRACE.BIN (Mega 2560 only) --
+// host/sio_replay.cpp plays a trace back against the firmware on a PC
+//#define SIO_SNIFFER
+
+// uncomment to paint the stack at boot and track free RAM and the stack high-water mark
+// after every SIO command (logged with DEBUG and readable with the SDrive memory command)
+//#define MEMORY_PROBE
+
+// uncomment to remember the mounted image (and its directory) in EEPROM and mount it
+// again at power-on instead of /AUTORUN.ATR
+//#define SESSION_RESTORE
+
+// uncomment to emulate printers P1-P4 and spool what's printed to /PRINTnnn.TXT files
+// (one per print job; Mega 2560 only -- output is buffered in 1K of RAM)
+//#define PRINTER_SPOOL
+
+// uncomment to convert spooled printer output from ATASCII to plain ASCII text
+//#define PRINTER_ASCII
+
+// uncomment to emulate the R1: port of an 850 interface (including concurrent mode for
+// terminal software) on Serial2 (Mega 2560 only)
+//#define RS232_DEVICE
+
+// uncomment to serve D1: from an image on a host computer running host/sio2host.c whenever
+// one is connected to the USB serial port (Mega 2560 or Teensy; it can't be used with DEBUG,
+// which logs to the same port, and the build stops with an error if either is the case)
+//#define HOST_IMAGES
+
+// uncomment to keep recently used sectors of ATR/XFD images in RAM and write changed ones
+// back to the card in the background (2KB; Mega 2560 only) -- a power loss within a couple
+// of seconds of a write loses it
+//#define SECTOR_CACHE
+
+// uncomment to open every disk of a multi-disk set (a .SET file listing the images) when
+// it's mounted, so the selector button swaps between them instantly (Mega 2560 only)
+//#define DISK_SETS
+
+// uncomment to also treat images named NAME1.ATR, NAME2.ATR, ... as a set (needs
+// DISK_SETS) -- mounting any image whose name ends in 1 then costs a directory search
+//#define NUMBERED_DISK_SETS
+
+// uncomment to read /SIO2ARD.CFG at startup, which can change the SIO rate and timing
+// profile, the SD card clock and the sector cache's read-ahead and write-back delay
+// without reflashing (see settings.h)
+//#define SETTINGS_FILE
+
+// uncomment for the SDrive duplicate command, which copies an image on the card (as
+// NAME_A.ATR, NAME_B.ATR, ...) in the background (Mega 2560 only)
+//#define IMAGE_COPY
+
+// the SIO timing profile used at startup: TIMING_810, TIMING_1050 or TIMING_FAST (gaps close
+// to the SIO spec minimums, which may not suit every OS) -- it can be changed at runtime with
+// the SDrive set timing command
+#define TIMING_PROFILE TIMING_1050
+
 // uncomment this to enable debug logging -- make sure the HARDWARE_UART isn't the same as
 // the LOGGING_UART defined at the bottom of the file
 //#define DEBUG 
@@ -123,6 +196,23 @@
   #endif
 #endif
 
+// the hardware UART the R1: device is bridged to
+#ifdef RS232_DEVICE
+  #define RS232_UART   Serial2
+#endif
+
+// the USB serial port host images are served over
+#ifdef HOST_IMAGES
+  #define HOST_UART      Serial
+  #define HOST_BAUD_RATE 115200
+#endif
+
+// the SIO bus rate (outside of R1: concurrent mode)
+#define SIO_BAUD_RATE  19200
+
+// the SD card's SPI clock in MHz (SdFat runs it as fast as the board allows up to this)
+#define SD_SPI_MHZ     50
+
 // the hardware UART to use for SIO bus communication
 #if defined(ARDUINO_MEGA) || defined(ARDUINO_TEENSY)
   #define SIO_UART     Serial1
@@ -147,4 +237,9 @@
   #define LOG_MSG_FLUSH()
 #endif
 
+// host images share the USB serial port with the debug log and need a second UART for SIO
+#if defined(HOST_IMAGES) && (defined(DEBUG) || defined(ARDUINO_UNO))
+  #error "HOST_IMAGES needs a Mega 2560 or Teensy and can't be used with DEBUG"
+#endif
+
 #endif
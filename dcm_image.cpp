@@ -0,0 +1,341 @@
+/*
+ * dcm_image.cpp - Serves DiskComm (DCM) archives as disks.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "dcm_image.h"
+
+#ifdef DCM_IMAGES
+boolean DCMImage::isDCMImage(byte* header, char* extension) {
+  // the archive type byte alone is too weak a signature, so check the name too
+  return ((header[0] == DCM_ARCHIVE_SINGLE || header[0] == DCM_ARCHIVE_MULTI) && (!strcmp(".DCM", extension) || !strcmp(".dcm", extension)));
+}
+
+/**
+ * Checks an archive's header and loads its sector index from the cache file (NAME.DCI)
+ * in dir if there's a current one. Otherwise the index is left for indexSectors() to
+ * build. Returns false for unsupported archives.
+ */
+boolean DCMImage::load(SdFile* file, SdFile* dir, byte* header, char* filename) {
+  m_file = file;
+  m_dir = dir;
+  m_lastBlock = 0;
+  strcpy(m_name, filename);
+
+  // a multi-file archive spreads its passes over several files, so none of them holds
+  // the whole disk (and only the first starts at pass 1)
+  if (header[0] == DCM_ARCHIVE_MULTI || (header[1] & DCM_PASS_NUMBER) != 1) {
+    LOG_MSG(F("Unsupported multi-file DCM: "));
+    return false;
+  }
+
+  // double density images won't fit the sector buffer
+  byte density = (header[1] >> DCM_DENSITY_SHIFT) & 0x03;
+  if (density == DCM_DENSITY_DOUBLE) {
+    LOG_MSG(F("Unsupported DCM density: "));
+    return false;
+  }
+  m_enhanced = (density == DCM_DENSITY_ENHANCED);
+  m_sectorCount = m_enhanced ? 1040 : 720;
+
+  // start from the beginning of the archive unless the cached index is current
+  m_indexLastPass = (m_dir && loadIndex());
+  if (!m_indexLastPass) {
+    memset(m_index, 0, sizeof(m_index));
+  }
+  m_indexPosition = 0;
+  m_indexPass = 0;
+  m_indexInPass = false;
+
+  return true;
+}
+
+/**
+ * Indexes the next few blocks of the archive, recording the file offset of each sector's
+ * block. Sectors that never appear (DiskComm omits empty ones) keep an offset of 0. Once
+ * the last pass is done the index is saved to the cache file.
+ */
+byte DCMImage::indexSectors() {
+  if (m_indexLastPass && !m_indexInPass) {
+    return INDEX_DONE;
+  }
+
+  m_file->seekSet(m_indexPosition);
+  for (byte n=0; n < DCM_INDEX_STEP_BLOCKS; n++) {
+    if (!m_indexInPass) {
+      // pass header: archive type, pass info (last pass flag, density, pass number),
+      // starting sector -- the passes have to follow on from each other
+      m_indexPass++;
+      int archiveType = m_file->read();
+      int passInfo = m_file->read();
+      if (archiveType != DCM_ARCHIVE_SINGLE || passInfo < 0 || (passInfo & DCM_PASS_NUMBER) != (m_indexPass & DCM_PASS_NUMBER)) {
+        return INDEX_FAILED;
+      }
+      m_indexLastPass = (passInfo & DCM_LAST_PASS);
+      m_indexInPass = true;
+      m_indexSector = m_file->read();
+      m_indexSector += m_file->read() << 8;
+    }
+
+    unsigned long offset = m_file->curPosition();
+    int type = m_file->read();
+    if (type < 0) {
+      return INDEX_FAILED;
+    }
+    if ((type & 0x7F) == DCM_END_PASS) {
+      m_indexInPass = false;
+      if (m_indexLastPass) {
+        if (m_dir) {
+          saveIndex();
+        }
+        return INDEX_DONE;
+      }
+      continue;
+    }
+    if (m_indexSector < 1 || m_indexSector > m_sectorCount || !decodeBlock(type, NULL)) {
+      return INDEX_FAILED;
+    }
+    setOffset(m_indexSector - 1, offset);
+
+    if (type & DCM_SEQUENTIAL) {
+      m_indexSector++;
+    } else {
+      m_indexSector = m_file->read();
+      m_indexSector += m_file->read() << 8;
+    }
+  }
+
+  m_indexPosition = m_file->curPosition();
+  return INDEX_RUNNING;
+}
+
+/**
+ * Opening the cache file moves the directory's read position (a failed lookup or a new
+ * entry leaves it at the end), and the selector button's scan and SDrive's listing carry
+ * on from there, so it's put back afterwards.
+ */
+boolean DCMImage::loadIndex() {
+  SdFile indexFile;
+  DCMIndexHeader header;
+  int size = m_sectorCount * 3;
+  uint32_t dirPosition = m_dir->curPosition();
+
+  strcpy(m_name + strlen(m_name) - 3, "DCI");
+  boolean result = (indexFile.open(m_dir, m_name, O_READ) &&
+                    indexFile.read(&header, sizeof(header)) == sizeof(header) &&
+                    !memcmp(header.magic, "DCI1", 4) &&
+                    header.dcmSize == m_file->fileSize() &&
+                    header.sectorCount == m_sectorCount &&
+                    indexFile.read(m_index, size) == size);
+  indexFile.close();
+  strcpy(m_name + strlen(m_name) - 3, "DCM");
+  m_dir->seekSet(dirPosition);
+
+  return result;
+}
+
+void DCMImage::saveIndex() {
+  SdFile indexFile;
+  DCMIndexHeader header;
+  uint32_t dirPosition = m_dir->curPosition();
+
+  memcpy(header.magic, "DCI1", 4);
+  header.dcmSize = m_file->fileSize();
+  header.sectorCount = m_sectorCount;
+
+  strcpy(m_name + strlen(m_name) - 3, "DCI");
+  if (indexFile.open(m_dir, m_name, O_WRONLY | O_CREAT | O_TRUNC)) {
+    indexFile.write(&header, sizeof(header));
+    indexFile.write(m_index, m_sectorCount * 3);
+    indexFile.close();
+  }
+  strcpy(m_name + strlen(m_name) - 3, "DCM");
+  m_dir->seekSet(dirPosition);
+}
+
+/**
+ * Decodes the DCM block at the current file position into data, which must hold the
+ * previous block's sector (the "modify" and "same as previous" types are deltas against
+ * it). If data is NULL the block is only skipped over.
+ */
+boolean DCMImage::decodeBlock(byte type, byte *data) {
+  int offset;
+  int b;
+
+  switch (type & 0x7F) {
+    case DCM_MODIFY_BEGIN:
+      // changed bytes from offset down to 0, in reverse order
+      offset = m_file->read();
+      if (offset >= SECTOR_SIZE_SD) {
+        return false;
+      }
+      for (; offset >= 0; offset--) {
+        b = m_file->read();
+        if (data) {
+          data[offset] = b;
+        }
+      }
+      break;
+    case DCM_DOS_SECTOR:
+      // an otherwise empty DOS sector -- only the last 5 bytes are stored
+      for (offset=0; offset < SECTOR_SIZE_SD; offset++) {
+        b = (offset < SECTOR_SIZE_SD - 5) ? 0 : m_file->read();
+        if (data) {
+          data[offset] = b;
+        }
+      }
+      break;
+    case DCM_COMPRESSED:
+      // alternating runs of literal bytes and fills, each prefixed with its end offset
+      offset = 0;
+      while (offset < SECTOR_SIZE_SD) {
+        int end = m_file->read();
+        if (end < offset || end > SECTOR_SIZE_SD) {
+          return false;
+        }
+        for (; offset < end; offset++) {
+          b = m_file->read();
+          if (data) {
+            data[offset] = b;
+          }
+        }
+        if (offset == SECTOR_SIZE_SD) {
+          break;
+        }
+        end = m_file->read();
+        b = m_file->read();
+        if (end <= offset || end > SECTOR_SIZE_SD) {
+          return false;
+        }
+        for (; offset < end; offset++) {
+          if (data) {
+            data[offset] = b;
+          }
+        }
+      }
+      break;
+    case DCM_MODIFY_END:
+      // changed bytes from offset to the end of the sector
+      offset = m_file->read();
+      if (offset >= SECTOR_SIZE_SD) {
+        return false;
+      }
+      for (; offset < SECTOR_SIZE_SD; offset++) {
+        b = m_file->read();
+        if (data) {
+          data[offset] = b;
+        }
+      }
+      break;
+    case DCM_SAME_AS_PREVIOUS:
+      break;
+    case DCM_UNCOMPRESSED:
+      for (offset=0; offset < SECTOR_SIZE_SD; offset++) {
+        b = m_file->read();
+        if (data) {
+          data[offset] = b;
+        }
+      }
+      break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+/**
+ * Decodes a sector from a DCM image. Delta blocks are replayed forward from the nearest
+ * self-contained block (or from the last block decoded, which is usually the previous
+ * sector when the Atari reads sequentially).
+ */
+void DCMImage::getSectorData(unsigned long sector, byte *data) {
+  unsigned long target = (sector >= 1 && sector <= m_sectorCount) ? getOffset(sector - 1) : 0;
+  if (!target) {
+    memset(data, 0, SECTOR_SIZE_SD);
+    return;
+  }
+
+  // walk back to a block we can start decoding from
+  unsigned long block = target;
+  while (true) {
+    m_file->seekSet(block);
+    byte type = m_file->read() & 0x7F;
+    if (type != DCM_MODIFY_BEGIN && type != DCM_MODIFY_END && type != DCM_SAME_AS_PREVIOUS) {
+      break;
+    }
+    unsigned long prev = getAdjacentBlock(block, false);
+    if (!prev) {
+      memset(m_buffer, 0, sizeof(m_buffer));
+      break;
+    }
+    if (prev == m_lastBlock) {
+      break;
+    }
+    block = prev;
+  }
+
+  // then replay blocks forward until the requested one is decoded
+  while (block) {
+    m_file->seekSet(block);
+    decodeBlock(m_file->read(), m_buffer);
+    if (block == target) {
+      break;
+    }
+    block = getAdjacentBlock(block, true);
+  }
+  m_lastBlock = target;
+
+  memcpy(data, m_buffer, SECTOR_SIZE_SD);
+}
+
+unsigned int DCMImage::getSectorCount() {
+  return m_sectorCount;
+}
+
+boolean DCMImage::isEnhancedDensity() {
+  return m_enhanced;
+}
+
+unsigned long DCMImage::getOffset(unsigned int ix) {
+  return m_index[ix][0] + ((unsigned long)m_index[ix][1] << 8) + ((unsigned long)m_index[ix][2] << 16);
+}
+
+void DCMImage::setOffset(unsigned int ix, unsigned long offset) {
+  m_index[ix][0] = offset & 0xFF;
+  m_index[ix][1] = (offset >> 8) & 0xFF;
+  m_index[ix][2] = (offset >> 16) & 0xFF;
+}
+
+/**
+ * Returns the file offset of the block immediately before (or after) the given one in
+ * the archive, or 0 if there isn't one.
+ */
+unsigned long DCMImage::getAdjacentBlock(unsigned long offset, boolean next) {
+  unsigned long result = 0;
+  for (unsigned int i=0; i < m_sectorCount; i++) {
+    unsigned long o = getOffset(i);
+    if (o && (next ? (o > offset && (!result || o < result)) : (o < offset && o > result))) {
+      result = o;
+    }
+  }
+  return result;
+}
+#endif
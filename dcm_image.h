@@ -0,0 +1,71 @@
+#ifndef DCM_IMAGE_h
+#define DCM_IMAGE_h
+
+#include "image_format.h"
+
+#ifdef DCM_IMAGES
+#define DCM_MAX_SECTORS       1040
+#define DCM_ARCHIVE_SINGLE    0xFA
+#define DCM_ARCHIVE_MULTI     0xF9
+#define DCM_LAST_PASS         0x80
+#define DCM_PASS_NUMBER       0x1F
+#define DCM_DENSITY_SHIFT     5
+#define DCM_DENSITY_DOUBLE    1
+#define DCM_DENSITY_ENHANCED  2
+#define DCM_SEQUENTIAL        0x80
+#define DCM_MODIFY_BEGIN      0x41
+#define DCM_DOS_SECTOR        0x42
+#define DCM_COMPRESSED        0x43
+#define DCM_MODIFY_END        0x44
+#define DCM_END_PASS          0x45
+#define DCM_SAME_AS_PREVIOUS  0x46
+#define DCM_UNCOMPRESSED      0x47
+
+// blocks indexed per background step (each one is read a byte at a time)
+#define DCM_INDEX_STEP_BLOCKS 16
+
+// header of the sector index cache written next to a DCM image (NAME.DCI)
+struct DCMIndexHeader {
+  char magic[4];
+  unsigned long dcmSize;
+  unsigned int sectorCount;
+};
+
+/**
+ * A DiskComm archive, decoded a sector at a time through an index of block offsets.
+ * Without a current index cache the index is built a few blocks at a time by
+ * indexSectors().
+ */
+class DCMImage {
+public:
+  static boolean isDCMImage(byte* header, char* extension);
+  boolean load(SdFile* file, SdFile* dir, byte* header, char* filename);
+  byte indexSectors();
+  unsigned int getSectorCount();
+  void getSectorData(unsigned long sector, byte* data);
+  boolean isEnhancedDensity();
+private:
+  boolean loadIndex();
+  void saveIndex();
+  boolean decodeBlock(byte type, byte* data);
+  unsigned long getOffset(unsigned int ix);
+  void setOffset(unsigned int ix, unsigned long offset);
+  unsigned long getAdjacentBlock(unsigned long offset, boolean next);
+
+  SdFile*          m_file;
+  SdFile*          m_dir;
+  char             m_name[13];
+  byte             m_index[DCM_MAX_SECTORS][3];
+  unsigned int     m_sectorCount;
+  boolean          m_enhanced;
+  unsigned long    m_lastBlock;
+  unsigned long    m_indexPosition;
+  unsigned int     m_indexSector;
+  byte             m_indexPass;
+  boolean          m_indexInPass;
+  boolean          m_indexLastPass;
+  byte             m_buffer[SECTOR_SIZE_SD];
+};
+#endif
+
+#endif
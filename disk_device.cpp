@@ -0,0 +1,320 @@
+/*
+ * disk_device.cpp - Handles SIO commands for an emulated disk drive.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "disk_device.h"
+#include "config.h"
+
+const byte DISK_COMMANDS[] PROGMEM = {
+  CMD_READ, CMD_WRITE, CMD_STATUS, CMD_PUT, CMD_FORMAT, CMD_FORMAT_MD, CMD_READ_BURST, 0
+};
+
+DiskDevice::DiskDevice(byte deviceId, DriveAccess* driveAccess) : SIODevice(deviceId, 1, DISK_COMMANDS) {
+  m_driveAccess = driveAccess;
+  m_driveNumber = deviceId & 0x0F;
+}
+
+int DiskDevice::processCommand(CommandFrame* cmdFrame, Stream* stream) {
+  switch (cmdFrame->command) {
+    case CMD_READ:
+      cmdGetSector(cmdFrame, stream);
+      break;
+    case CMD_READ_BURST:
+      cmdGetSectorBurst(cmdFrame, stream);
+      break;
+    case CMD_WRITE:
+    case CMD_PUT:
+      return cmdPutSector(stream);
+    case CMD_STATUS:
+      cmdGetStatus(stream);
+      break;
+    case CMD_FORMAT:
+      cmdFormat(DENSITY_SD, stream);
+      break;
+    case CMD_FORMAT_MD:
+      cmdFormat(DENSITY_ED, stream);
+      break;
+  }
+  
+  return 0;
+}
+
+byte* DiskDevice::getDataFrameBuffer() {
+  return m_sectorBuffer;
+}
+
+void DiskDevice::cmdGetSector(CommandFrame* cmdFrame, Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_READ, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+  STATS_MARK(ackTime);
+
+  // write data frame + checksum
+  STATS_MARK(readTime);
+  SectorDataInfo *p = m_driveAccess->readSectorFunc(m_driveNumber, getCommandSector(cmdFrame), (byte*)&m_sectorBuffer);
+  STATS_RECORD(STAT_CLASS_READ, STAT_SD_READ, readTime);
+  m_timing->waitFor(TIMING_T5);
+  if (p != NULL && !p->error) {
+    // send complete 
+    stream->write(COMPLETE);
+  } else {
+    // send error
+    stream->write(ERR);
+  }
+  STATS_RECORD(STAT_CLASS_READ, STAT_ACK_TO_COMPLETE, ackTime);
+
+  stream->flush();
+
+  m_timing->mark();
+  m_timing->waitFor(TIMING_DATA);
+
+  STATS_MARK(txTime);
+
+  if (p != NULL) {
+    // write data
+    stream->write(m_sectorBuffer, p->length);
+    // write checksum
+    stream->write(checksum((byte*)&m_sectorBuffer, p->length));
+  } else {
+    // write empty data + checksum
+    for (int i=0; i < SD_SECTOR_SIZE + 1; i++) {
+      stream->write((byte)0x00);
+    }
+  }
+
+  stream->flush();
+  STATS_RECORD(STAT_CLASS_READ, STAT_DATA_TX, txTime);
+}
+
+/**
+ * Sends a run of sectors in a single data frame with one checksum, which saves the
+ * command frame, ACK, COMPLETE and gaps of every sector after the first. The Atari side
+ * has to ask for a buffer of count * sector size bytes.
+ */
+void DiskDevice::cmdGetSectorBurst(CommandFrame* cmdFrame, Stream* stream) {
+  unsigned long sector = getBurstSector(cmdFrame);
+  byte count = getBurstCount(cmdFrame);
+
+  // a failure can't be reported once COMPLETE has gone out, so a burst that runs off
+  // the end of the disk is turned away before it starts
+  DriveStatus* driveStatus = m_driveAccess->deviceStatusFunc(m_driveNumber);
+  if (sector < 1 || sector + count - 1 > driveStatus->sectorCount) {
+    m_timing->waitFor(TIMING_T2);
+    stream->write(NAK);
+    STATS_COUNT(STAT_COUNT_NAK);
+    return;
+  }
+
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_READ, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+  STATS_MARK(ackTime);
+
+  // the first sector decides between COMPLETE and ERR and sets the frame length
+  STATS_MARK(readTime);
+  SectorDataInfo *p = m_driveAccess->readSectorFunc(m_driveNumber, sector, (byte*)&m_sectorBuffer);
+  STATS_RECORD(STAT_CLASS_READ, STAT_SD_READ, readTime);
+  boolean error = (p == NULL || p->error);
+  unsigned long length = p ? p->length : SD_SECTOR_SIZE;
+  m_timing->waitFor(TIMING_T5);
+  stream->write(error ? ERR : COMPLETE);
+  STATS_RECORD(STAT_CLASS_READ, STAT_ACK_TO_COMPLETE, ackTime);
+
+  stream->flush();
+
+  m_timing->mark();
+  m_timing->waitFor(TIMING_DATA);
+
+  STATS_MARK(txTime);
+
+  byte chkSum = 0;
+  for (byte n=0; n < count; n++) {
+    // the remaining sectors are read while the UART drains the previous one
+    if (n > 0) {
+      p = m_driveAccess->readSectorFunc(m_driveNumber, sector + n, (byte*)&m_sectorBuffer);
+      if (p == NULL || p->error || p->length != length) {
+        error = true;
+      }
+    }
+    if (p == NULL || p->length != length) {
+      memset(m_sectorBuffer, 0, length);
+    }
+
+    // write data
+    stream->write(m_sectorBuffer, length);
+    chkSum = checksum((byte*)&m_sectorBuffer, length, chkSum);
+  }
+
+  // COMPLETE has already gone out, so a sector that fails part way through the burst
+  // spoils the checksum instead and the Atari retries the whole frame
+  if (error) {
+    chkSum = ~chkSum;
+  }
+  stream->write(chkSum);
+
+  stream->flush();
+  STATS_RECORD(STAT_CLASS_READ, STAT_DATA_TX, txTime);
+}
+
+int DiskDevice::cmdPutSector(Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_WRITE, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+
+  // have the channel read the sector data frame
+  DriveStatus *status = m_driveAccess->deviceStatusFunc(m_driveNumber);
+  return status->sectorSize + 1;
+}
+  
+void DiskDevice::processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T4);
+  stream->write(ACK);
+  STATS_MARK(ackTime);
+
+  // write sector to disk image
+  STATS_MARK(writeTime);
+  boolean result = m_driveAccess->writeSectorFunc(m_driveNumber, getCommandSector(cmdFrame), m_sectorBuffer, length);
+  STATS_RECORD(STAT_CLASS_WRITE, STAT_SD_WRITE, writeTime);
+  m_timing->waitFor(TIMING_T5);
+  if (result) {
+    // send COMPLETE
+    stream->write(COMPLETE);
+  } else {
+    LOG_MSG_CR(F("Write to device error"));
+    stream->write(ERR);
+  }
+  STATS_RECORD(STAT_CLASS_WRITE, STAT_ACK_TO_COMPLETE, ackTime);
+}
+
+void DiskDevice::cmdGetStatus(Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_STATUS, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+  STATS_MARK(ackTime);
+
+  // send complete 
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+  STATS_RECORD(STAT_CLASS_STATUS, STAT_ACK_TO_COMPLETE, ackTime);
+  STATS_MARK(txTime);
+
+  // get device status
+  DriveStatus* driveStatus = m_driveAccess->deviceStatusFunc(m_driveNumber);
+
+  // calculate checksum
+  int frameLength = sizeof(driveStatus->statusFrame);
+  byte chksum = checksum((byte*)&driveStatus->statusFrame, frameLength);
+
+  // send status to bus
+  stream->write((byte*)&driveStatus->statusFrame, frameLength);
+  stream->write(chksum);
+  stream->flush();
+  STATS_RECORD(STAT_CLASS_STATUS, STAT_DATA_TX, txTime);
+}
+
+void DiskDevice::cmdFormat(int density, Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_OTHER, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+  STATS_MARK(ackTime);
+
+  // perform image format
+  boolean result = m_driveAccess->formatFunc(m_driveNumber, density);
+  m_timing->waitFor(TIMING_T5);
+  if (result) {
+    // send COMPLETE
+    stream->write(COMPLETE);
+    STATS_RECORD(STAT_CLASS_OTHER, STAT_ACK_TO_COMPLETE, ackTime);
+    
+    LOG_MSG(F("Sending data frame of length "));
+    LOG_MSG_CR(SD_SECTOR_SIZE);
+
+    stream->write(0xFF);
+    stream->write(0xFF);
+    for (int i=0; i < SD_SECTOR_SIZE - 3; i++) {
+      stream->write((byte)0x00);
+    }
+    stream->write(0xFF);
+    stream->write(0xFF);
+  } else {
+    stream->write(ERR);
+  }
+}
+
+boolean DiskDevice::printCmdName(CommandFrame* cmdFrame) {
+// we only compile this on DEBUG to save allocating string constants
+#ifdef DEBUG
+  switch (cmdFrame->command) {
+    case CMD_STATUS:
+      LOG_MSG(F("STATUS"));
+      break;
+    case CMD_POLL:
+      LOG_MSG(F("POLL"));
+      break;
+    case CMD_READ:
+      LOG_MSG(F("READ "));
+      LOG_MSG(getCommandSector(cmdFrame));
+      break;
+    case CMD_READ_BURST:
+      LOG_MSG(F("READ BURST "));
+      LOG_MSG(getBurstSector(cmdFrame));
+      LOG_MSG(F(" x "));
+      LOG_MSG(getBurstCount(cmdFrame));
+      break;
+    case CMD_WRITE:
+      LOG_MSG(F("WRITE "));
+      LOG_MSG(getCommandSector(cmdFrame));
+      break;
+    case CMD_PUT:
+      LOG_MSG(F("PUT "));
+      LOG_MSG(getCommandSector(cmdFrame));
+      break;
+    case CMD_FORMAT:
+      LOG_MSG(F("FORMAT"));
+      break;
+    case CMD_FORMAT_MD:
+      LOG_MSG(F("FORMAT MD"));
+      break;
+    default:
+      return false;
+  }
+#endif
+
+  return true;
+}
+
+unsigned long DiskDevice::getCommandSector(CommandFrame* cmdFrame) {
+  return (unsigned long)(cmdFrame->aux2 << 8) + (cmdFrame->aux1 & 0xff);
+}
+
+unsigned long DiskDevice::getBurstSector(CommandFrame* cmdFrame) {
+  return (unsigned long)((cmdFrame->aux2 & BURST_SECTOR_HIGH_MASK) << 8) + (cmdFrame->aux1 & 0xff);
+}
+
+byte DiskDevice::getBurstCount(CommandFrame* cmdFrame) {
+  return (cmdFrame->aux2 >> BURST_COUNT_SHIFT) + 1;
+}
@@ -0,0 +1,49 @@
+#ifndef DISK_DEVICE_h
+#define DISK_DEVICE_h
+
+#include <Arduino.h>
+#include "atari.h"
+#include "drive_access.h"
+#include "sio_device.h"
+
+const byte CMD_FORMAT           = 0x21;
+const byte CMD_FORMAT_MD        = 0x22;
+const byte CMD_POLL             = 0x3F;
+const byte CMD_PUT              = 0x50;
+const byte CMD_READ             = 0x52;
+const byte CMD_STATUS           = 0x53;
+const byte CMD_WRITE            = 0x57;
+const byte CMD_READ_BURST       = 0x72;
+
+// a burst read packs an 11 bit start sector and a sector count (1-32) into the aux bytes:
+// aux1 and the low 3 bits of aux2 are the sector, the high 5 bits of aux2 are the count - 1
+const byte BURST_SECTOR_HIGH_MASK = 0x07;
+const byte BURST_COUNT_SHIFT      = 3;
+
+/**
+ * The SIO side of an emulated disk drive: handles the disk commands and passes sector
+ * access through to the drive access functions.
+ */
+class DiskDevice : public SIODevice {
+public:
+  DiskDevice(byte deviceId, DriveAccess* driveAccess);
+  int processCommand(CommandFrame* cmdFrame, Stream* stream);
+  byte* getDataFrameBuffer();
+  void processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream);
+  boolean printCmdName(CommandFrame* cmdFrame);
+private:
+  void cmdGetSector(CommandFrame* cmdFrame, Stream* stream);
+  void cmdGetSectorBurst(CommandFrame* cmdFrame, Stream* stream);
+  int cmdPutSector(Stream* stream);
+  void cmdGetStatus(Stream* stream);
+  void cmdFormat(int density, Stream* stream);
+  unsigned long getCommandSector(CommandFrame* cmdFrame);
+  unsigned long getBurstSector(CommandFrame* cmdFrame);
+  byte getBurstCount(CommandFrame* cmdFrame);
+
+  DriveAccess*      m_driveAccess;
+  byte              m_driveNumber;
+  byte              m_sectorBuffer[MAX_SECTOR_SIZE + 1];
+};
+
+#endif
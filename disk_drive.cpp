@@ -22,12 +22,23 @@
 */
 #include "disk_drive.h"
 
+#ifdef SECTOR_CACHE
+DiskDrive::DiskDrive() : m_cache(&m_diskImage) {
+  memset(&m_cachedInfo, 0, sizeof(m_cachedInfo));
+  m_cachedInfo.length = SD_SECTOR_SIZE;
+#else
 DiskDrive::DiskDrive() {
+#endif
   // reset device status
   memset(&m_driveStatus.statusFrame, 0, sizeof(m_driveStatus.statusFrame));
 
   // set standard attributes
   m_driveStatus.statusFrame.timeout_lsb = 0xE0;
+  m_driveStatus.sectorCount = 0;
+
+#ifdef SECTOR_PROFILER
+  m_profileName[0] = 0;
+#endif
 }
 
 DriveStatus* DiskDrive::getStatus() {
@@ -35,8 +46,26 @@ DriveStatus* DiskDrive::getStatus() {
   return &m_driveStatus;
 }
 
-boolean DiskDrive::setImageFile(SdFile *file) {
-  boolean result = m_diskImage.setFile(file);
+boolean DiskDrive::setImageFile(SdFile *file, SdFile *dir) {
+#ifdef SECTOR_PROFILER
+  // the previous image is going away, so save what we learned about it
+  writeProfile();
+  memset(m_profile, 0, sizeof(m_profile));
+  m_lastSector = 0;
+  m_accessCount = 0;
+  m_overflowCount = 0;
+  m_gapMin = 0xFFFFFFFF;
+  m_gapMax = 0;
+  m_gapTotal = 0;
+  m_profileName[0] = 0;
+#endif
+
+#ifdef SECTOR_CACHE
+  // (anything dirty was flushed before the old file was closed)
+  m_cache.clear();
+#endif
+
+  boolean result = m_diskImage.setFile(file, dir);
   if (result) {
     // set device status
     memset(&m_driveStatus.statusFrame, 0, sizeof(m_driveStatus.statusFrame));
@@ -44,15 +73,46 @@ boolean DiskDrive::setImageFile(SdFile *file) {
     m_driveStatus.statusFrame.commandStatus.doubleDensity = m_diskImage.isDoubleDensity() ? 0x01 : 0x00;
     m_driveStatus.statusFrame.hardwareStatus.writeProtect = m_diskImage.isReadOnly() ? 0x00 : 0x01;
     m_driveStatus.sectorSize = m_diskImage.getSectorSize();
+    m_driveStatus.sectorCount = m_diskImage.getSectorCount();
+#ifdef SECTOR_PROFILER
+    file->getName(m_profileName, 13);
+#endif
+  } else {
+    m_driveStatus.sectorCount = 0;
   }
+
+#ifdef SECTOR_CACHE
+  if (result && isCacheable()) {
+    m_cache.preload();
+  }
+#endif
+
   return result;
 }
 
 SectorDataInfo* DiskDrive::getSectorData(unsigned long sector, byte *data) {
   if (m_diskImage.hasImage()) {
     unsigned long startTime = micros();
+
+#ifdef SECTOR_PROFILER
+    profileAccess(sector, false);
+#endif
     
+#ifdef SECTOR_CACHE
+    if (isCacheable()) {
+      m_cache.noteRead(sector);
+      if (m_cache.read(sector, data)) {
+        return &m_cachedInfo;
+      }
+    }
+#endif
+
     SectorDataInfo *info = m_diskImage.getSectorData(sector, data);
+#ifdef SECTOR_CACHE
+    if (isCacheable() && !info->error) {
+      m_cache.fill(sector, data);
+    }
+#endif
     // store the status frame if valid
     if (info->validStatusFrame) {
       memcpy(&m_driveStatus.statusFrame, &(info->statusFrame), sizeof(m_driveStatus.statusFrame));
@@ -74,13 +134,178 @@ SectorDataInfo* DiskDrive::getSectorData(unsigned long sector, byte *data) {
 }
 
 unsigned long DiskDrive::writeSectorData(unsigned long sector, byte *data, unsigned long len) {
+#ifdef SECTOR_PROFILER
+  profileAccess(sector, true);
+#endif
+#ifdef SECTOR_CACHE
+  if (isCacheable() && len == SD_SECTOR_SIZE && !m_diskImage.isReadOnly()) {
+    return m_cache.write(sector, data) ? len : 0;
+  }
+#endif
   return m_diskImage.writeSectorData(sector, data, len);
 }
 
 boolean DiskDrive::formatImage(SdFile *file, int density) {
-  return m_diskImage.format(file, density);
+  boolean result = m_diskImage.format(file, density);
+  if (result) {
+    // (the format may have changed the sector size)
+    m_driveStatus.sectorSize = m_diskImage.getSectorSize();
+    m_driveStatus.sectorCount = m_diskImage.getSectorCount();
+  }
+#ifdef SECTOR_CACHE
+  // whatever was cached belonged to the old contents
+  m_cache.clear();
+#endif
+  return result;
+}
+
+boolean DiskDrive::continueFormat() {
+  return m_diskImage.continueFormat();
+}
+
+/**
+ * Background task that indexes a newly mounted image (an invalid one gets unmounted).
+ */
+boolean DiskDrive::continueLoad() {
+  boolean done = m_diskImage.continueLoad();
+  if (done && !m_diskImage.hasImage()) {
+    m_driveStatus.sectorCount = 0;
+  }
+  return done;
 }
 
 boolean DiskDrive::hasImage() {
   return m_diskImage.hasImage();
 }
+
+#ifdef SECTOR_CACHE
+/**
+ * Only plain single density images are cached (the other formats either can't be
+ * written or depend on every read reaching them).
+ */
+boolean DiskDrive::isCacheable() {
+  byte type = m_diskImage.getType();
+  return ((type == TYPE_ATR || type == TYPE_XFD) && m_diskImage.getSectorSize() == SD_SECTOR_SIZE);
+}
+
+void DiskDrive::setCacheTuning(byte readAhead, unsigned int writeDelay) {
+  m_cache.setTuning(readAhead, writeDelay);
+}
+
+boolean DiskDrive::hasDirtySectors() {
+  return m_cache.isDirty();
+}
+
+/**
+ * Background task that moves written sectors from the cache to the image.
+ */
+boolean DiskDrive::writeBackCache() {
+  return m_cache.writeBack();
+}
+
+boolean DiskDrive::hasReadAhead() {
+  return m_cache.hasReadAhead();
+}
+
+/**
+ * Background task that reads sectors the Atari is about to ask for into the cache.
+ */
+boolean DiskDrive::readAheadCache() {
+  return m_cache.readAhead();
+}
+
+/**
+ * Writes every cached change to the image now. This has to happen before its file is
+ * closed.
+ */
+boolean DiskDrive::flushCache() {
+  return m_cache.flush();
+}
+#endif
+
+#ifdef SECTOR_PROFILER
+/**
+ * Counts a sector access. A "re-read" is a read of the same sector as the access
+ * right before it (OS retries and copy-protection checks show up this way).
+ */
+void DiskDrive::profileAccess(unsigned long sector, boolean write) {
+  unsigned long now = micros();
+
+  if (m_accessCount > 0) {
+    unsigned long gap = now - m_lastAccessTime;
+    m_gapTotal += gap;
+    if (gap < m_gapMin) {
+      m_gapMin = gap;
+    }
+    if (gap > m_gapMax) {
+      m_gapMax = gap;
+    }
+  }
+  m_lastAccessTime = now;
+  m_accessCount++;
+
+  if (sector >= 1 && sector <= PROFILER_MAX_SECTORS) {
+    SectorProfile *p = &m_profile[sector - 1];
+    if (write) {
+      if (p->writes < 0xFF) {
+        p->writes++;
+      }
+    } else {
+      if (p->reads < 0xFF) {
+        p->reads++;
+      }
+      if (sector == m_lastSector && p->rereads < 0xFF) {
+        p->rereads++;
+      }
+    }
+  } else {
+    m_overflowCount++;
+  }
+  m_lastSector = write ? 0 : sector;
+}
+
+/**
+ * Appends the profile of the current image to the profile file: a summary line with
+ * the image name, access count, min/avg/max gap between accesses (in us) and the number
+ * of accesses past PROFILER_MAX_SECTORS, then one line per sector that was touched.
+ */
+void DiskDrive::writeProfile() {
+  if (!m_accessCount) {
+    return;
+  }
+
+  SdFile out;
+  if (!out.open(PROFILER_FILENAME, O_WRONLY | O_CREAT | O_APPEND)) {
+    return;
+  }
+
+  out.print(F("# "));
+  out.print(m_profileName);
+  out.print(',');
+  out.print(m_accessCount);
+  out.print(',');
+  out.print(m_accessCount > 1 ? m_gapMin : 0);
+  out.print(',');
+  out.print(m_accessCount > 1 ? m_gapTotal / (m_accessCount - 1) : 0);
+  out.print(',');
+  out.print(m_gapMax);
+  out.print(',');
+  out.println(m_overflowCount);
+  out.println(F("sector,reads,writes,rereads"));
+
+  for (unsigned int i=0; i < PROFILER_MAX_SECTORS; i++) {
+    SectorProfile *p = &m_profile[i];
+    if (p->reads || p->writes) {
+      out.print(i + 1);
+      out.print(',');
+      out.print(p->reads);
+      out.print(',');
+      out.print(p->writes);
+      out.print(',');
+      out.println(p->rereads);
+    }
+  }
+
+  out.close();
+}
+#endif
@@ -3,23 +3,70 @@
 
 #include <Arduino.h>
 #include "atari.h"
+#include "config.h"
 #include "disk_image.h"
+#include "sector_cache.h"
 
-const unsigned long MIN_PRO_SECTOR_READ = 25000 - DELAY_T5 * 1000;
+const unsigned long MIN_PRO_SECTOR_READ = 25000;
+
+#ifdef SECTOR_PROFILER
+// (accesses past this are only counted, in the summary line)
+#define PROFILER_MAX_SECTORS 720
+#define PROFILER_FILENAME    "/SECTPROF.CSV"
+
+// counts saturate at 255
+struct SectorProfile {
+  byte reads;
+  byte writes;
+  byte rereads;
+};
+#endif
 
 class DiskDrive {
 public:
   DiskDrive();
   DriveStatus* getStatus();
-  boolean setImageFile(SdFile* file);
+  boolean setImageFile(SdFile* file, SdFile* dir = NULL);
   unsigned long getImageSectorSize();
   SectorDataInfo* getSectorData(unsigned long sector, byte *data);
   unsigned long writeSectorData(unsigned long sector, byte* data, unsigned long len);
   boolean formatImage(SdFile* file, int density);
+  boolean continueFormat();
+  boolean continueLoad();
   boolean hasImage();
+#ifdef SECTOR_CACHE
+  void setCacheTuning(byte readAhead, unsigned int writeDelay);
+  boolean hasDirtySectors();
+  boolean writeBackCache();
+  boolean hasReadAhead();
+  boolean readAheadCache();
+  boolean flushCache();
+#endif
 private:
+#ifdef SECTOR_CACHE
+  boolean isCacheable();
+#endif
+#ifdef SECTOR_PROFILER
+  void profileAccess(unsigned long sector, boolean write);
+  void writeProfile();
+#endif
   DriveStatus  m_driveStatus;
   DiskImage    m_diskImage;
+#ifdef SECTOR_CACHE
+  SectorCache    m_cache;
+  SectorDataInfo m_cachedInfo;
+#endif
+#ifdef SECTOR_PROFILER
+  SectorProfile m_profile[PROFILER_MAX_SECTORS];
+  char          m_profileName[13];
+  unsigned long m_lastSector;
+  unsigned long m_lastAccessTime;
+  unsigned long m_accessCount;
+  unsigned long m_overflowCount;
+  unsigned long m_gapMin;
+  unsigned long m_gapMax;
+  unsigned long m_gapTotal;
+#endif
 };
 
 #endif
@@ -5,7 +5,14 @@
 #include <SdFat.h>
 #include "atari.h"
 #include "config.h"
+#include "image_format.h"
+#include "pro_image.h"
+#include "atx_image.h"
+#include "xex_image.h"
+#include "vdos_image.h"
+#include "dcm_image.h"
 
+#define TYPE_NONE 0
 #define TYPE_ATR 1
 #define TYPE_XFD 2
 #ifdef PRO_IMAGES
@@ -17,91 +24,62 @@
 #ifdef XEX_IMAGES
 #define TYPE_XEX 5
 #endif
+#ifdef VDOS_IMAGES
+#define TYPE_VDOS 6
+#endif
+#ifdef DCM_IMAGES
+#define TYPE_DCM 7
+#endif
 
-#define SECTOR_SIZE_SD  128
 #define FORMAT_SS_SD_40 92160
 
-#ifdef ATX_IMAGES
-struct ATXSectorHeader {
-  unsigned int sectorNumber;
-  unsigned long fileIndex;
-  byte sstatus;
-};
-#endif
+// how much of a new image gets zero-filled per background step (each write is synced,
+// so bigger chunks mean fewer card writes but longer steps)
+#define FORMAT_CHUNK_SIZE 64
 
 // ATR format
 #define ATR_SIGNATURE 0x0296
+// (fixed width and packed, so it's read the same way in a host build)
 struct ATRHeader {
-  unsigned int signature;
-  unsigned int pars;
-  unsigned int secSize;
+  uint16_t signature;
+  uint16_t pars;
+  uint16_t secSize;
   byte parsHigh;
-  unsigned long crc;
-  unsigned long unused;
+  uint32_t crc;
+  uint32_t unused;
   byte flags;
-};
-
-#ifdef PRO_IMAGES
-// PRO format
-const byte PSM_SIMPLE            = 0;
-const byte PSM_MINDSCAPE_SPECIAL = 1;
-const byte PSM_GLOBAL_FLIP_FLOP  = 2;
-const byte PSM_GLOBAL_FLOP_FLIP  = 3;
-const byte PSM_HEURISTIC         = 4;
-const byte PSM_STICKY            = 5;
-const byte PSM_REVERSE_STICKY    = 6;
-const byte PSM_SHIMMERING        = 7;
-const byte PSM_REVERSE_SHIMMER   = 8;
-const byte PSM_ROLLING_THUNDER   = 9;
-
-struct PROFileHeader {
-  byte sectorCountHi;
-  byte sectorCountLo;
-  byte magic;
-  byte imageType;
-  byte phantomSectorMode;
-  byte sectorReadDelay;
-  byte g;
-  byte h;
-  byte i;
-  byte j;
-  byte k;
-  byte l;
-  byte m;
-  byte n;
-  byte o;
-  byte p;
-};
-
-struct PROSectorHeader {
-  StatusFrame statusFrame;
-  byte m;
-  byte totalPhantoms;
-  byte phantom4;
-  byte phantom1;
-  byte phantom2;
-  byte phantom3;
-  byte n;
-  byte phantom5;
-};
-#endif
+} __attribute__((packed));
 
+/**
+ * A mounted disk image. ATR and XFD images are read directly; every other format has
+ * its own handler class. Only one image is loaded at a time, so the handlers share
+ * storage and a disabled format costs neither RAM nor flash. Formats that need an index
+ * are mounted once their header checks out and indexed by continueLoad().
+ */
 class DiskImage {
 public:
   DiskImage();
-  boolean setFile(SdFile* file);
+  ~DiskImage();
+  boolean setFile(SdFile* file, SdFile* dir = NULL);
   byte getType();
   unsigned long getSectorSize();
+  unsigned long getSectorCount();
   SectorDataInfo* getSectorData(unsigned long sector, byte* data);
   unsigned long writeSectorData(unsigned long, byte* data, unsigned long size);
   boolean format(SdFile *file, int density);
+  boolean continueFormat();
+  boolean continueLoad();
   boolean isEnhancedDensity();
   boolean isDoubleDensity();
   boolean isReadOnly();
   boolean hasImage();
   boolean hasCopyProtection();
 private:
-  boolean loadFile(SdFile* file);
+  boolean loadFile(SdFile* file, SdFile* dir);
+  byte loadStep();
+  void unloadFormat();
+  void fillTo(unsigned long offset);
+
   SdFile*          m_fileRef;
   byte             m_type;
   unsigned long    m_fileSize;
@@ -109,15 +87,27 @@ private:
   unsigned long    m_headerSize;
   unsigned long    m_sectorSize;
   byte             m_sectorReadDelay;
+  unsigned long    m_formatEnd;
+  boolean          m_loading;
   SectorDataInfo   m_sectorInfo;
-  boolean          m_usePhantoms;
-  boolean          m_phantomFlip;
+  union {
+    byte           m_noFormat;
 #ifdef PRO_IMAGES
-  PROSectorHeader  m_proSectorHeader;
-#endif  
+    PROImage       m_pro;
+#endif
 #ifdef ATX_IMAGES
-  ATXSectorHeader  m_sectorHeaders[720];
+    ATXImage       m_atx;
+#endif
+#ifdef XEX_IMAGES
+    XEXImage       m_xex;
+#endif
+#ifdef VDOS_IMAGES
+    VDOSImage      m_vdos;
+#endif
+#ifdef DCM_IMAGES
+    DCMImage       m_dcm;
 #endif
+  };
 };
 
 #endif
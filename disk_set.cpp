@@ -0,0 +1,194 @@
+/*
+ * disk_set.cpp - Keeps the disks of a multi-disk program open for instant swapping.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "disk_set.h"
+#include "config.h"
+
+#ifdef DISK_SETS
+
+DiskSet::DiskSet() {
+  m_count = 0;
+  m_current = 0;
+}
+
+/**
+ * Opens every disk of the set the given file starts. Returns false if it doesn't start
+ * one (or none of its disks could be opened).
+ */
+boolean DiskSet::load(SdFile* dir, char* name) {
+  char* extension = strrchr(name, '.');
+  m_count = 0;
+  m_current = 0;
+
+  if (extension && (!strcmp(extension, ".SET") || !strcmp(extension, ".set"))) {
+    loadList(dir, name);
+  }
+#ifdef NUMBERED_DISK_SETS
+  else {
+    loadNumbered(dir, name);
+  }
+#endif
+
+  if (m_count) {
+    LOG_MSG(F("Loaded disk set of "));
+    LOG_MSG(m_count);
+    LOG_MSG(F(": "));
+  }
+  return (m_count > 0);
+}
+
+/**
+ * Closes every disk of the set. The mounted file is one of them, so it ends up closed too.
+ */
+void DiskSet::close(SdFile* mounted) {
+  if (m_count) {
+    byte current = m_current;
+    m_files[current] = *mounted;
+    closeAll();
+    *mounted = m_files[current];
+  }
+}
+
+/**
+ * Swaps the given disk of the set into the mounted file (which has to be closed, or
+ * already hold the set's current disk).
+ */
+void DiskSet::select(SdFile* mounted, byte ix) {
+  if (mounted->isOpen()) {
+    m_files[m_current] = *mounted;
+  }
+  m_current = ix;
+  *mounted = m_files[ix];
+}
+
+boolean DiskSet::isActive() {
+  return (m_count > 0);
+}
+
+byte DiskSet::getCount() {
+  return m_count;
+}
+
+byte DiskSet::getCurrent() {
+  return m_current;
+}
+
+char* DiskSet::getName(byte ix) {
+  return m_names[ix];
+}
+
+/**
+ * Opens the images listed in a .SET file, one name per line (blank lines and lines
+ * starting with # are skipped).
+ */
+boolean DiskSet::loadList(SdFile* dir, char* name) {
+  SdFile list;
+  char line[DISK_SET_NAME_SIZE];
+  byte len = 0;
+  boolean skip = false;
+
+  if (!list.open(dir, name, O_READ)) {
+    return false;
+  }
+
+  int c;
+  do {
+    c = list.read();
+    if (c < 0 || c == '\n' || c == '\r') {
+      line[len] = 0;
+      if (len && !skip && !add(dir, line)) {
+        break;
+      }
+      len = 0;
+      skip = false;
+    } else if (c == '#' && !len) {
+      skip = true;
+    } else if (c != ' ' && c != '\t' && len < DISK_SET_NAME_SIZE - 1) {
+      line[len++] = c;
+    }
+  } while (c >= 0);
+
+  list.close();
+  return (m_count > 0);
+}
+
+#ifdef NUMBERED_DISK_SETS
+/**
+ * Opens a numbered series of images (NAME1.EXT, NAME2.EXT, ...) starting with the given
+ * one, as long as there's at least a second disk. Each disk is looked up once, by
+ * opening it, and the first one missing ends the series.
+ */
+boolean DiskSet::loadNumbered(SdFile* dir, char* name) {
+  char disk[DISK_SET_NAME_SIZE];
+  char* extension = strrchr(name, '.');
+
+  if (!extension || extension == name || extension[-1] != '1') {
+    return false;
+  }
+
+  // (the digit is the character before the extension)
+  strcpy(disk, name);
+  char* digit = disk + (extension - name) - 1;
+
+  for (byte i=0; i < DISK_SET_MAX && i < 9; i++) {
+    *digit = '1' + i;
+    if (!m_files[m_count].open(dir, disk, O_RDWR | O_SYNC)) {
+      break;
+    }
+    strcpy(m_names[m_count], disk);
+    m_count++;
+  }
+
+  // a series that turned out to be a single disk isn't a set
+  if (m_count < 2) {
+    closeAll();
+  }
+  return (m_count > 0);
+}
+#endif
+
+/**
+ * Opens the next disk of the set. Returns false once the set is full.
+ */
+boolean DiskSet::add(SdFile* dir, char* name) {
+  if (m_count == DISK_SET_MAX) {
+    return false;
+  }
+  if (m_files[m_count].open(dir, name, O_RDWR | O_SYNC)) {
+    strcpy(m_names[m_count], name);
+    m_count++;
+  } else {
+    LOG_MSG(F("Unable to open set disk "));
+    LOG_MSG_CR(name);
+  }
+  return true;
+}
+
+void DiskSet::closeAll() {
+  for (byte i=0; i < m_count; i++) {
+    m_files[i].close();
+  }
+  m_count = 0;
+  m_current = 0;
+}
+
+#endif
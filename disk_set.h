@@ -0,0 +1,47 @@
+#ifndef DISK_SET_h
+#define DISK_SET_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include "config.h"
+
+// the most disks a set can hold (each keeps an open file)
+const byte DISK_SET_MAX              = 6;
+const byte DISK_SET_NAME_SIZE        = 13;
+
+/**
+ * The disks of a multi-disk program, all opened when the set is mounted so swapping
+ * disks never has to look anything up on the card. A set is either a .SET file (a
+ * text file listing one image in the same directory per line) or, with
+ * NUMBERED_DISK_SETS, a numbered series of images, e.g. GAME1.ATR, GAME2.ATR, ...,
+ * picked up when its first disk is mounted.
+ *
+ * The mounted disk is a copy of its handle in the mounted file, which is copied back
+ * before another disk is swapped in. Images are opened with O_SYNC, so neither copy
+ * is ever holding changes the other hasn't seen.
+ */
+class DiskSet {
+public:
+  DiskSet();
+  boolean load(SdFile* dir, char* name);
+  void close(SdFile* mounted);
+  void select(SdFile* mounted, byte ix);
+  boolean isActive();
+  byte getCount();
+  byte getCurrent();
+  char* getName(byte ix);
+private:
+  boolean loadList(SdFile* dir, char* name);
+#ifdef NUMBERED_DISK_SETS
+  boolean loadNumbered(SdFile* dir, char* name);
+#endif
+  boolean add(SdFile* dir, char* name);
+  void closeAll();
+
+  SdFile  m_files[DISK_SET_MAX];
+  char    m_names[DISK_SET_MAX][DISK_SET_NAME_SIZE];
+  byte    m_count;
+  byte    m_current;
+};
+
+#endif
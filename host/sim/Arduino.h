@@ -0,0 +1,128 @@
+#ifndef SIM_ARDUINO_h
+#define SIM_ARDUINO_h
+
+/*
+ * The parts of the Arduino core the firmware uses, so it can be built on a Linux host
+ * (see host/sio_replay.cpp). Time comes from the simulator's virtual clock (see sim.h)
+ * rather than the wall clock, which makes every run repeatable.
+ */
+#include <ctype.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH          1
+#define LOW           0
+#define INPUT         0
+#define OUTPUT        1
+#define INPUT_PULLUP  2
+
+#define DEC  10
+#define HEX  16
+
+// there's no separate program memory
+inline uint16_t simReadWord(const void* p) {
+  uint16_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+inline uint32_t simReadDword(const void* p) {
+  uint32_t d;
+  memcpy(&d, p, sizeof(d));
+  return d;
+}
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+#define pgm_read_word(p)  simReadWord(p)
+#define pgm_read_dword(p) simReadDword(p)
+#define memcpy_P  memcpy
+#define strcmp_P  strcmp
+#define strncmp_P strncmp
+#define strcpy_P  strcpy
+#define strncpy_P strncpy
+#define strlen_P  strlen
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper*)(s))
+
+// (templates rather than the AVR core's macros, which would break the C++ library)
+template<typename T, typename U> inline typename std::common_type<T, U>::type min(T a, U b) {
+  return (a < b) ? a : b;
+}
+template<typename T, typename U> inline typename std::common_type<T, U>::type max(T a, U b) {
+  return (a > b) ? a : b;
+}
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void pinMode(uint8_t pin, uint8_t mode);
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size);
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper* s);
+  size_t print(const char* s);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+  size_t println();
+  template<typename T> size_t println(T value) { size_t n = print(value); return n + println(); }
+  template<typename T> size_t println(T value, int format) { size_t n = print(value, format); return n + println(); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+/**
+ * A serial port that writes to stderr (so DEBUG logging shows up) and never receives.
+ */
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baudRate) {}
+  void begin(unsigned long baudRate, uint8_t format) {}
+  void end() {}
+  int available() { return 0; }
+  int read() { return -1; }
+  int peek() { return -1; }
+  int availableForWrite() { return 64; }
+  size_t write(uint8_t b) { fputc(b, stderr); return 1; }
+  using Print::write;
+  void flush() { fflush(stderr); }
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+extern HardwareSerial Serial2;
+extern HardwareSerial Serial3;
+
+#endif
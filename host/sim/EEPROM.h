@@ -0,0 +1,24 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+#include "Arduino.h"
+
+/**
+ * The simulated EEPROM, erased (all 0xFF) at startup like a new board's.
+ */
+class EEPROMClass {
+public:
+  EEPROMClass() { memset(m_data, 0xFF, sizeof(m_data)); }
+  uint8_t read(int address) { return m_data[address]; }
+  void write(int address, uint8_t value) { m_data[address] = value; }
+  void update(int address, uint8_t value) { m_data[address] = value; }
+  template<typename T> T& get(int address, T& t) { memcpy(&t, m_data + address, sizeof(T)); return t; }
+  template<typename T> const T& put(int address, const T& t) { memcpy(m_data + address, &t, sizeof(T)); return t; }
+  uint16_t length() { return sizeof(m_data); }
+private:
+  uint8_t m_data[4096];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
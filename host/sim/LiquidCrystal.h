@@ -0,0 +1,19 @@
+#ifndef LiquidCrystal_h
+#define LiquidCrystal_h
+
+#include "Arduino.h"
+
+/**
+ * The simulator has no LCD; this is only here so lcd_display.h can be included.
+ */
+class LiquidCrystal : public Print {
+public:
+  LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3) {}
+  void begin(uint8_t cols, uint8_t rows) {}
+  void clear() {}
+  void setCursor(uint8_t col, uint8_t row) {}
+  virtual size_t write(uint8_t b) { return 1; }
+  using Print::write;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef SIM_SDFAT_h
+#define SIM_SDFAT_h
+
+/*
+ * The parts of SdFat 2.x the firmware uses, backed by the simulator's in-memory card
+ * (see sim.h) instead of an SD card.
+ */
+#include <Arduino.h>
+
+typedef uint8_t oflag_t;
+
+#define O_READ    0x00
+#define O_RDONLY  0x00
+#define O_WRITE   0x01
+#define O_WRONLY  0x01
+#define O_RDWR    0x02
+#define O_APPEND  0x04
+#define O_CREAT   0x08
+#define O_EXCL    0x10
+#define O_TRUNC   0x20
+#define O_SYNC    0x40
+#define O_AT_END  0x80
+
+#define SD_SCK_MHZ(mhz) (mhz)
+
+#define FAT_ATTRIB_READ_ONLY  0x01
+#define FAT_ATTRIB_HIDDEN     0x02
+#define FAT_ATTRIB_DIRECTORY  0x10
+
+// a FAT directory entry
+struct DirFat_t {
+  uint8_t name[11];
+  uint8_t attributes;
+  uint8_t caseFlags;
+  uint8_t createTimeMs;
+  uint8_t createTime[2];
+  uint8_t createDate[2];
+  uint8_t accessDate[2];
+  uint8_t firstClusterHigh[2];
+  uint8_t modifyTime[2];
+  uint8_t modifyDate[2];
+  uint8_t firstClusterLow[2];
+  uint8_t fileSize[4];
+};
+
+inline bool isSubdir(const DirFat_t* dir) {
+  return (dir->attributes & FAT_ATTRIB_DIRECTORY) != 0;
+}
+
+struct SimNode;
+
+class SdFile : public Stream {
+public:
+  SdFile();
+  bool open(const char* path, oflag_t flags = O_READ);
+  bool open(SdFile* dir, const char* name, oflag_t flags = O_READ);
+  bool open(SdFile* dir, uint16_t index, oflag_t flags = O_READ);
+  bool openNext(SdFile* dir, oflag_t flags = O_READ);
+  bool close();
+  bool remove();
+  bool exists(const char* name);
+  bool isOpen() const;
+  bool isDir() const;
+  bool isFile() const;
+  bool isHidden() const;
+  uint32_t fileSize() const;
+  uint32_t curPosition() const;
+  uint16_t dirIndex() const;
+  bool seekSet(uint32_t pos);
+  bool seekCur(int32_t offset);
+  void rewind();
+  int read();
+  int read(void* buffer, size_t count);
+  int peek();
+  int available();
+  size_t write(uint8_t b);
+  size_t write(const void* buffer, size_t count);
+  size_t write(const uint8_t* buffer, size_t count) { return write((const void*)buffer, count); }
+  using Print::write;
+  void flush();
+  bool sync();
+  bool truncate(uint32_t length);
+  bool preAllocate(uint32_t length);
+  int8_t readDir(DirFat_t* dir);
+  bool dirEntry(DirFat_t* dir);
+  bool getName(char* name, size_t size);
+private:
+  SimNode*  m_node;
+  uint32_t  m_pos;
+  oflag_t   m_flags;
+  bool      m_modified;
+};
+
+class SdFat32 {
+public:
+  bool begin(uint8_t csPin, uint32_t maxSck);
+  bool exists(const char* path);
+  bool remove(const char* path);
+};
+
+#endif
@@ -0,0 +1,2 @@
+// the AVR core's placement new
+#include <new>
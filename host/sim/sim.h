@@ -0,0 +1,113 @@
+#ifndef SIM_h
+#define SIM_h
+
+/*
+ * A simulated Arduino for running the firmware on a Linux host: a virtual clock, an
+ * in-memory SD card with a latency model, an SIO bus that stands in for the UART and
+ * command line, and the sketch's drive wiring. Nothing the simulated firmware does
+ * touches the host's files.
+ */
+#include <Arduino.h>
+#include <SdFat.h>
+#include <deque>
+#include "atari.h"
+
+// how far the clock moves on every micros() or millis() call (the firmware's busy waits
+// poll the clock, so this is what gets them to finish) and on every pass of the loop
+const unsigned long SIM_CALL_TIME     = 4;
+const unsigned long SIM_LOOP_TIME     = 20;
+
+// how many bytes the UART takes before a write has to wait (HardwareSerial's TX buffer)
+const byte SIM_TX_BUFFER              = 64;
+
+/*
+ * The virtual clock, in microseconds since the simulation started.
+ */
+unsigned long long simNow();
+void simAdvance(unsigned long long us);
+void simAdvanceTo(unsigned long long time);
+
+/*
+ * The card. Files are laid out contiguously in 512 byte blocks and, like SdFat, a single
+ * block is cached: every access outside it costs a block read (after writing the cached
+ * block back if it's dirty), whole aligned blocks go straight to and from the card, and
+ * syncing a changed file also rewrites its directory entry's block.
+ */
+struct SimCardModel {
+  unsigned long readLatency;      // reading a block (us)
+  unsigned long writeLatency;     // writing a block (us)
+  unsigned long straddlePenalty;  // extra for an access that spans two blocks (us)
+  unsigned long busyInterval;     // block writes between the card's busy periods (0 for none)
+  unsigned long busyTime;         // how long a busy period lasts (us)
+};
+
+struct SimCardStats {
+  unsigned long       blockReads;
+  unsigned long       blockWrites;
+  unsigned long       busyPeriods;
+  unsigned long long  time;       // total time spent waiting on the card (us)
+};
+
+extern const SimCardModel SIM_DEFAULT_CARD;
+
+void simCardSetModel(const SimCardModel* model);
+SimCardStats* simCardGetStats();
+boolean simCardAddDir(const char* path);
+boolean simCardAddFile(const char* path, const byte* data, unsigned long length);
+boolean simCardLoadFile(const char* path, const char* hostPath);
+
+/*
+ * A byte on the simulated bus: when it was written (which is when SIOSniffer would have
+ * stamped it) and when it had gone over the wire.
+ */
+struct SimByte {
+  byte                data;
+  unsigned long long  time;
+  unsigned long long  end;
+};
+
+/**
+ * The SIO bus as the firmware sees it: the Stream the channel talks to, plus the command
+ * line. The Atari side (a trace or a benchmark workload) sends bytes with send() and
+ * picks up the firmware's bytes with receive(). Bytes take their real time on the wire
+ * in both directions, so the UART's busy time is known and flush() waits like the
+ * hardware does.
+ */
+class SimBus : public Stream {
+public:
+  SimBus();
+  void setBaudRate(unsigned long baudRate);
+  unsigned long getByteTime();
+  void setCommandLine(boolean asserted);
+  boolean isCommandAsserted();
+  void send(byte b, unsigned long long time);
+  boolean hasPendingInput();
+  boolean receive(SimByte* b);
+  unsigned long long getBusyTime();
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t b);
+  using Print::write;
+  int availableForWrite();
+  void flush();
+private:
+  unsigned long         m_byteTime;
+  boolean               m_cmdAsserted;
+  unsigned long long    m_rxFree;
+  unsigned long long    m_txFree;
+  unsigned long long    m_busyTime;
+  std::deque<SimByte>   m_rx;
+  std::deque<SimByte>   m_tx;
+};
+
+extern SimBus simBus;
+
+/*
+ * The firmware, wired up the way SIO2Arduino.ino does it for D1: and the SDrive device.
+ */
+void simFirmwareSetup();
+boolean simFirmwareMount(const char* name);
+void simFirmwareLoop();
+
+#endif
@@ -0,0 +1,134 @@
+/*
+ * sim_bus.cpp - The simulated SIO bus.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sim.h"
+#include "config.h"
+
+SimBus simBus;
+
+SimBus::SimBus() {
+  m_cmdAsserted = false;
+  m_rxFree = 0;
+  m_txFree = 0;
+  m_busyTime = 0;
+  setBaudRate(SIO_BAUD_RATE);
+}
+
+void SimBus::setBaudRate(unsigned long baudRate) {
+  // a start bit, 8 data bits and a stop bit
+  m_byteTime = 10000000UL / baudRate;
+}
+
+unsigned long SimBus::getByteTime() {
+  return m_byteTime;
+}
+
+void SimBus::setCommandLine(boolean asserted) {
+  m_cmdAsserted = asserted;
+}
+
+boolean SimBus::isCommandAsserted() {
+  return m_cmdAsserted;
+}
+
+/**
+ * Puts a byte from the Atari on the wire at the given time (or once the bytes before it
+ * are through). The firmware can read it when it has arrived.
+ */
+void SimBus::send(byte b, unsigned long long time) {
+  SimByte sent;
+  sent.data = b;
+  sent.time = max(time, m_rxFree);
+  sent.end = sent.time + m_byteTime;
+  m_rxFree = sent.end;
+  m_busyTime += m_byteTime;
+  m_rx.push_back(sent);
+}
+
+boolean SimBus::hasPendingInput() {
+  return !m_rx.empty();
+}
+
+/**
+ * Takes the next byte the firmware has written, whether or not it's through the UART yet
+ * (its end time says when the Atari has it).
+ */
+boolean SimBus::receive(SimByte* b) {
+  if (m_tx.empty()) {
+    return false;
+  }
+  *b = m_tx.front();
+  m_tx.pop_front();
+  return true;
+}
+
+unsigned long long SimBus::getBusyTime() {
+  return m_busyTime;
+}
+
+int SimBus::available() {
+  return (!m_rx.empty() && m_rx.front().end <= simNow()) ? 1 : 0;
+}
+
+int SimBus::read() {
+  if (!available()) {
+    return -1;
+  }
+  byte b = m_rx.front().data;
+  m_rx.pop_front();
+  return b;
+}
+
+int SimBus::peek() {
+  return available() ? m_rx.front().data : -1;
+}
+
+/**
+ * Queues a byte for the UART, waiting first if its buffer is full.
+ */
+size_t SimBus::write(uint8_t b) {
+  unsigned long long buffered = (unsigned long long)SIM_TX_BUFFER * m_byteTime;
+  if (m_txFree > simNow() + buffered) {
+    simAdvanceTo(m_txFree - buffered);
+  }
+
+  SimByte written;
+  written.data = b;
+  written.time = simNow();
+  written.end = max(written.time, m_txFree) + m_byteTime;
+  m_txFree = written.end;
+  m_busyTime += m_byteTime;
+  m_tx.push_back(written);
+  return 1;
+}
+
+int SimBus::availableForWrite() {
+  unsigned long long queued = (m_txFree > simNow()) ? (m_txFree - simNow() + m_byteTime - 1) / m_byteTime : 0;
+  return (queued < SIM_TX_BUFFER) ? SIM_TX_BUFFER - queued : 0;
+}
+
+/**
+ * Waits for everything written to go out, like HardwareSerial::flush().
+ */
+void SimBus::flush() {
+  simAdvanceTo(m_txFree);
+}
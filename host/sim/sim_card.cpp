@@ -0,0 +1,625 @@
+/*
+ * sim_card.cpp - The simulated SD card: SdFat's file API over an in-memory FAT volume,
+ * with a latency model.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include <vector>
+#include "sim.h"
+
+const unsigned long SIM_BLOCK_SIZE     = 512;
+const unsigned long SIM_DIR_ENTRY_SIZE = 32;
+
+// roughly a class 4 card driven over SPI by an AVR
+const SimCardModel SIM_DEFAULT_CARD = { 250, 600, 0, 64, 25000 };
+
+struct SimNode {
+  char                    name[13];
+  boolean                 isDir;
+  boolean                 removed;
+  SimNode*                parent;
+  uint16_t                dirIndex;
+  unsigned long           firstBlock;
+  unsigned long           blockCount;
+  std::vector<byte>       data;
+  std::vector<SimNode*>   children;
+};
+
+static SimNode root;
+static unsigned long nextFreeBlock = 1024;
+static SimCardModel model = SIM_DEFAULT_CARD;
+static SimCardStats stats;
+static long cachedBlock = -1;
+static boolean cacheDirty = false;
+
+void simCardSetModel(const SimCardModel* newModel) {
+  model = *newModel;
+}
+
+SimCardStats* simCardGetStats() {
+  return &stats;
+}
+
+/*
+ * The latency model.
+ */
+static void waitForCard(unsigned long us) {
+  simAdvance(us);
+  stats.time += us;
+}
+
+static void writeBlock() {
+  stats.blockWrites++;
+  waitForCard(model.writeLatency);
+  if (model.busyInterval && stats.blockWrites % model.busyInterval == 0) {
+    stats.busyPeriods++;
+    waitForCard(model.busyTime);
+  }
+}
+
+static void readBlock() {
+  stats.blockReads++;
+  waitForCard(model.readLatency);
+}
+
+static void flushCache() {
+  if (cacheDirty) {
+    writeBlock();
+    cacheDirty = false;
+  }
+}
+
+static void cacheBlock(unsigned long block, boolean read) {
+  if (cachedBlock == (long)block) {
+    return;
+  }
+  flushCache();
+  if (read) {
+    readBlock();
+  }
+  cachedBlock = block;
+}
+
+/*
+ * The volume's layout: every file and directory is a contiguous run of blocks (with
+ * room to grow), and a directory's entries are 32 bytes each.
+ */
+static void allocate(SimNode* node, unsigned long size) {
+  unsigned long blocks = (size + SIM_BLOCK_SIZE - 1) / SIM_BLOCK_SIZE;
+  if (blocks == 0) {
+    blocks = 1;
+  }
+  if (blocks > node->blockCount) {
+    node->blockCount = blocks * 2;
+    node->firstBlock = nextFreeBlock;
+    nextFreeBlock += node->blockCount;
+  }
+}
+
+static boolean createRoot() {
+  strcpy(root.name, "/");
+  root.isDir = true;
+  allocate(&root, 0);
+  return true;
+}
+
+static boolean rootCreated = createRoot();
+
+static unsigned long getEntryBlock(SimNode* dir, uint16_t index) {
+  return dir->firstBlock + (unsigned long)index * SIM_DIR_ENTRY_SIZE / SIM_BLOCK_SIZE;
+}
+
+// subdirectories start with their . and .. entries
+static uint16_t getFirstIndex(SimNode* dir) {
+  return (dir == &root) ? 0 : 2;
+}
+
+static void toDosName(const char* name, uint8_t* dosName) {
+  memset(dosName, ' ', 11);
+  for (byte i=0; *name && *name != '.' && i < 8; i++) {
+    dosName[i] = toupper(*(name++));
+  }
+  name = strchr(name, '.');
+  if (name) {
+    name++;
+    for (byte i=8; *name && i < 11; i++) {
+      dosName[i] = toupper(*(name++));
+    }
+  }
+}
+
+/**
+ * Finds a directory's entry for a name the way SdFat does: one entry after another.
+ */
+static SimNode* findChild(SimNode* dir, const char* name) {
+  uint8_t dosName[11];
+  toDosName(name, dosName);
+
+  for (unsigned int i=0; i < dir->children.size(); i++) {
+    SimNode* child = dir->children[i];
+    cacheBlock(getEntryBlock(dir, child->dirIndex), true);
+    uint8_t childName[11];
+    toDosName(child->name, childName);
+    if (!child->removed && memcmp(dosName, childName, 11) == 0) {
+      return child;
+    }
+  }
+  return NULL;
+}
+
+static SimNode* addChild(SimNode* dir, const char* name, boolean isDir) {
+  SimNode* node = new SimNode();
+  strncpy(node->name, name, 12);
+  for (char* c=node->name; *c; c++) {
+    *c = toupper(*c);
+  }
+  node->isDir = isDir;
+  node->removed = false;
+  node->parent = dir;
+  node->dirIndex = getFirstIndex(dir) + dir->children.size();
+  node->blockCount = 0;
+  allocate(node, 0);
+
+  dir->children.push_back(node);
+  allocate(dir, (node->dirIndex + 1) * SIM_DIR_ENTRY_SIZE);
+  return node;
+}
+
+/**
+ * Follows a path from the root. Returns the parent directory and the last component if
+ * everything before it exists.
+ */
+static SimNode* findParent(const char* path, char* leaf) {
+  SimNode* dir = &root;
+  char component[13];
+
+  while (*path == '/') {
+    path++;
+  }
+  while (true) {
+    const char* end = strchr(path, '/');
+    if (!end) {
+      strncpy(leaf, path, 12);
+      leaf[12] = 0;
+      return dir;
+    }
+    unsigned int length = min(end - path, 12);
+    memcpy(component, path, length);
+    component[length] = 0;
+    dir = findChild(dir, component);
+    if (!dir || !dir->isDir) {
+      return NULL;
+    }
+    path = end + 1;
+  }
+}
+
+static SimNode* findPath(const char* path) {
+  char leaf[13];
+  SimNode* dir = findParent(path, leaf);
+  if (!dir) {
+    return NULL;
+  }
+  return leaf[0] ? findChild(dir, leaf) : dir;
+}
+
+boolean simCardAddDir(const char* path) {
+  char leaf[13];
+  SimNode* dir = findParent(path, leaf);
+  return (dir && leaf[0] && addChild(dir, leaf, true));
+}
+
+boolean simCardAddFile(const char* path, const byte* data, unsigned long length) {
+  char leaf[13];
+  SimNode* dir = findParent(path, leaf);
+  if (!dir || !leaf[0]) {
+    return false;
+  }
+  SimNode* node = addChild(dir, leaf, false);
+  node->data.assign(data, data + length);
+  allocate(node, length);
+  return true;
+}
+
+boolean simCardLoadFile(const char* path, const char* hostPath) {
+  FILE* f = fopen(hostPath, "rb");
+  if (!f) {
+    return false;
+  }
+  std::vector<byte> data;
+  int c;
+  while ((c = fgetc(f)) != EOF) {
+    data.push_back(c);
+  }
+  fclose(f);
+  return simCardAddFile(path, data.data(), data.size());
+}
+
+/*
+ * SdFile.
+ */
+SdFile::SdFile() {
+  m_node = NULL;
+  m_pos = 0;
+  m_flags = 0;
+  m_modified = false;
+}
+
+static boolean isWritable(oflag_t flags) {
+  return (flags & (O_WRITE | O_RDWR)) != 0;
+}
+
+/**
+ * Opens an entry that's been found (directories can only be opened to read, as with
+ * SdFat).
+ */
+static boolean openNode(SimNode* node, oflag_t flags, SimNode** opened, uint32_t* pos) {
+  if (!node || node->removed || (node->isDir && isWritable(flags))) {
+    return false;
+  }
+  if (flags & O_TRUNC) {
+    node->data.clear();
+  }
+  *opened = node;
+  *pos = (flags & (O_AT_END | O_APPEND)) ? node->data.size() : 0;
+  return true;
+}
+
+bool SdFile::open(const char* path, oflag_t flags) {
+  char leaf[13];
+  SimNode* dir = findParent(path, leaf);
+  if (!dir) {
+    return false;
+  }
+  if (!leaf[0]) {
+    m_modified = false;
+    m_flags = flags;
+    return openNode(dir, flags, &m_node, &m_pos);
+  }
+  SdFile parent;
+  parent.m_node = dir;
+  return open(&parent, leaf, flags);
+}
+
+bool SdFile::open(SdFile* dir, const char* name, oflag_t flags) {
+  if (!dir->isDir()) {
+    return false;
+  }
+  SimNode* node = findChild(dir->m_node, name);
+  if (node && (flags & O_CREAT) && (flags & O_EXCL)) {
+    return false;
+  }
+  if (!node && (flags & O_CREAT)) {
+    node = addChild(dir->m_node, name, false);
+    cacheBlock(getEntryBlock(dir->m_node, node->dirIndex), true);
+    cacheDirty = true;
+  }
+  m_modified = false;
+  m_flags = flags;
+  return openNode(node, flags, &m_node, &m_pos);
+}
+
+bool SdFile::open(SdFile* dir, uint16_t index, oflag_t flags) {
+  if (!dir->isDir() || index < getFirstIndex(dir->m_node)) {
+    return false;
+  }
+  unsigned int ix = index - getFirstIndex(dir->m_node);
+  if (ix >= dir->m_node->children.size()) {
+    return false;
+  }
+  cacheBlock(getEntryBlock(dir->m_node, index), true);
+  m_modified = false;
+  m_flags = flags;
+  return openNode(dir->m_node->children[ix], flags, &m_node, &m_pos);
+}
+
+bool SdFile::openNext(SdFile* dir, oflag_t flags) {
+  if (!dir->isDir()) {
+    return false;
+  }
+  while (true) {
+    unsigned int ix = dir->m_pos / SIM_DIR_ENTRY_SIZE;
+    if (ix >= dir->m_node->children.size()) {
+      return false;
+    }
+    dir->m_pos += SIM_DIR_ENTRY_SIZE;
+    SimNode* node = dir->m_node->children[ix];
+    cacheBlock(getEntryBlock(dir->m_node, node->dirIndex), true);
+    if (!node->removed) {
+      m_modified = false;
+      m_flags = flags;
+      return openNode(node, flags, &m_node, &m_pos);
+    }
+  }
+}
+
+bool SdFile::close() {
+  if (!m_node) {
+    return false;
+  }
+  bool result = sync();
+  m_node = NULL;
+  return result;
+}
+
+bool SdFile::remove() {
+  if (!m_node || m_node->isDir || !isWritable(m_flags)) {
+    return false;
+  }
+  m_node->removed = true;
+  cacheBlock(getEntryBlock(m_node->parent, m_node->dirIndex), true);
+  cacheDirty = true;
+  flushCache();
+  m_node = NULL;
+  return true;
+}
+
+bool SdFile::exists(const char* name) {
+  return isDir() && findChild(m_node, name) != NULL;
+}
+
+bool SdFile::isOpen() const {
+  return m_node != NULL;
+}
+
+bool SdFile::isDir() const {
+  return m_node && m_node->isDir;
+}
+
+bool SdFile::isFile() const {
+  return m_node && !m_node->isDir;
+}
+
+bool SdFile::isHidden() const {
+  return false;
+}
+
+uint32_t SdFile::fileSize() const {
+  return (m_node && !m_node->isDir) ? m_node->data.size() : 0;
+}
+
+uint32_t SdFile::curPosition() const {
+  return m_pos;
+}
+
+uint16_t SdFile::dirIndex() const {
+  return m_node ? m_node->dirIndex : 0;
+}
+
+bool SdFile::seekSet(uint32_t pos) {
+  if (!m_node || (pos > fileSize() && !isWritable(m_flags))) {
+    return false;
+  }
+  m_pos = pos;
+  return true;
+}
+
+bool SdFile::seekCur(int32_t offset) {
+  return seekSet(m_pos + offset);
+}
+
+void SdFile::rewind() {
+  m_pos = 0;
+}
+
+int SdFile::read() {
+  byte b;
+  return (read(&b, 1) == 1) ? b : -1;
+}
+
+/**
+ * Reads through the block cache, except for whole aligned blocks that aren't in it,
+ * which go straight to the caller's buffer.
+ */
+int SdFile::read(void* buffer, size_t count) {
+  if (!isFile()) {
+    return -1;
+  }
+  if (m_pos >= fileSize()) {
+    return 0;
+  }
+  count = min(count, fileSize() - m_pos);
+
+  unsigned long firstBlock = m_pos / SIM_BLOCK_SIZE;
+  unsigned long lastBlock = (m_pos + count - 1) / SIM_BLOCK_SIZE;
+  for (unsigned long block=firstBlock; block <= lastBlock; block++) {
+    unsigned long start = max(m_pos, block * SIM_BLOCK_SIZE);
+    unsigned long end = min(m_pos + count, (block + 1) * SIM_BLOCK_SIZE);
+    unsigned long cardBlock = m_node->firstBlock + block;
+    if (end - start == SIM_BLOCK_SIZE && cachedBlock != (long)cardBlock) {
+      readBlock();
+    } else {
+      cacheBlock(cardBlock, true);
+    }
+  }
+  if (lastBlock > firstBlock) {
+    waitForCard(model.straddlePenalty);
+  }
+
+  memcpy(buffer, &m_node->data[m_pos], count);
+  m_pos += count;
+  return count;
+}
+
+int SdFile::peek() {
+  uint32_t pos = m_pos;
+  int b = read();
+  m_pos = pos;
+  return b;
+}
+
+int SdFile::available() {
+  return (isFile() && m_pos < fileSize()) ? min(fileSize() - m_pos, 0x7FFFU) : 0;
+}
+
+size_t SdFile::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+/**
+ * Writes through the block cache (reading the block in first unless it's new), except
+ * for whole aligned blocks, which go straight to the card.
+ */
+size_t SdFile::write(const void* buffer, size_t count) {
+  if (!isFile() || !isWritable(m_flags)) {
+    return 0;
+  }
+  if (count == 0) {
+    return 0;
+  }
+  if (m_flags & O_APPEND) {
+    m_pos = fileSize();
+  }
+
+  unsigned long oldSize = fileSize();
+  if (m_pos + count > oldSize) {
+    m_node->data.resize(m_pos + count, 0);
+    allocate(m_node, m_pos + count);
+  }
+
+  unsigned long firstBlock = m_pos / SIM_BLOCK_SIZE;
+  unsigned long lastBlock = (m_pos + count - 1) / SIM_BLOCK_SIZE;
+  for (unsigned long block=firstBlock; block <= lastBlock; block++) {
+    unsigned long start = max(m_pos, block * SIM_BLOCK_SIZE);
+    unsigned long end = min(m_pos + count, (block + 1) * SIM_BLOCK_SIZE);
+    unsigned long cardBlock = m_node->firstBlock + block;
+    if (end - start == SIM_BLOCK_SIZE) {
+      if (cachedBlock == (long)cardBlock) {
+        cachedBlock = -1;
+        cacheDirty = false;
+      }
+      writeBlock();
+    } else {
+      // (nothing to read in a block that starts at or after the old end of the file)
+      cacheBlock(cardBlock, block * SIM_BLOCK_SIZE < oldSize);
+      cacheDirty = true;
+    }
+  }
+  if (lastBlock > firstBlock) {
+    waitForCard(model.straddlePenalty);
+  }
+
+  memcpy(&m_node->data[m_pos], buffer, count);
+  m_pos += count;
+  m_modified = true;
+
+  if (m_flags & O_SYNC) {
+    sync();
+  }
+  return count;
+}
+
+void SdFile::flush() {
+  sync();
+}
+
+/**
+ * Writes the cached block back and, if the file has changed, its directory entry.
+ */
+bool SdFile::sync() {
+  if (!m_node) {
+    return false;
+  }
+  if (m_modified && m_node->parent) {
+    cacheBlock(getEntryBlock(m_node->parent, m_node->dirIndex), true);
+    cacheDirty = true;
+    m_modified = false;
+  }
+  flushCache();
+  return true;
+}
+
+bool SdFile::truncate(uint32_t length) {
+  if (!isFile() || !isWritable(m_flags) || length > fileSize()) {
+    return false;
+  }
+  m_node->data.resize(length);
+  if (m_pos > length) {
+    m_pos = length;
+  }
+  m_modified = true;
+  return sync();
+}
+
+bool SdFile::preAllocate(uint32_t length) {
+  if (!isFile() || fileSize() != 0) {
+    return false;
+  }
+  allocate(m_node, length);
+  return true;
+}
+
+int8_t SdFile::readDir(DirFat_t* dir) {
+  if (!isDir()) {
+    return -1;
+  }
+  while (true) {
+    unsigned int ix = m_pos / SIM_DIR_ENTRY_SIZE;
+    if (ix >= m_node->children.size()) {
+      return 0;
+    }
+    m_pos += SIM_DIR_ENTRY_SIZE;
+    SimNode* node = m_node->children[ix];
+    cacheBlock(getEntryBlock(m_node, node->dirIndex), true);
+    if (!node->removed) {
+      SdFile entry;
+      entry.m_node = node;
+      entry.dirEntry(dir);
+      return SIM_DIR_ENTRY_SIZE;
+    }
+  }
+}
+
+bool SdFile::dirEntry(DirFat_t* dir) {
+  if (!m_node) {
+    return false;
+  }
+  memset(dir, 0, sizeof(DirFat_t));
+  toDosName(m_node->name, dir->name);
+  dir->attributes = m_node->isDir ? FAT_ATTRIB_DIRECTORY : 0;
+  uint32_t size = fileSize();
+  memcpy(dir->fileSize, &size, sizeof(size));
+  return true;
+}
+
+bool SdFile::getName(char* name, size_t size) {
+  if (!m_node || size == 0) {
+    return false;
+  }
+  strncpy(name, (m_node == &root) ? "/" : m_node->name, size - 1);
+  name[size - 1] = 0;
+  return true;
+}
+
+/*
+ * SdFat32.
+ */
+bool SdFat32::begin(uint8_t csPin, uint32_t maxSck) {
+  return rootCreated;
+}
+
+bool SdFat32::exists(const char* path) {
+  return findPath(path) != NULL;
+}
+
+bool SdFat32::remove(const char* path) {
+  SdFile file;
+  return file.open(path, O_WRONLY) && file.remove();
+}
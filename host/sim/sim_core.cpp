@@ -0,0 +1,138 @@
+/*
+ * sim_core.cpp - The simulated Arduino core: virtual clock, printing and pins.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sim.h"
+#include "EEPROM.h"
+#include "config.h"
+
+static unsigned long long now = 0;
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+HardwareSerial Serial2;
+HardwareSerial Serial3;
+EEPROMClass EEPROM;
+
+unsigned long long simNow() {
+  return now;
+}
+
+void simAdvance(unsigned long long us) {
+  now += us;
+}
+
+void simAdvanceTo(unsigned long long time) {
+  if (time > now) {
+    now = time;
+  }
+}
+
+// (both wrap at 32 bits like the AVR's)
+unsigned long micros() {
+  now += SIM_CALL_TIME;
+  return (uint32_t)now;
+}
+
+unsigned long millis() {
+  now += SIM_CALL_TIME;
+  return (uint32_t)(now / 1000);
+}
+
+void delay(unsigned long ms) {
+  now += (unsigned long long)ms * 1000;
+}
+
+void delayMicroseconds(unsigned int us) {
+  now += us;
+}
+
+void yield() {
+}
+
+int digitalRead(uint8_t pin) {
+  // the command line is active low; nothing else (e.g. a button) is ever pressed
+  if (pin == PIN_ATARI_CMD) {
+    return simBus.isCommandAsserted() ? LOW : HIGH;
+  }
+  return HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    n += write(*buffer++);
+  }
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper* s) {
+  return print((const char*)s);
+}
+
+size_t Print::print(const char* s) {
+  return write(s);
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base) {
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(int n, int base) {
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == DEC) {
+    return print('-') + print((unsigned long)-n, base);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buffer[24];
+  snprintf(buffer, sizeof(buffer), (base == HEX) ? "%lX" : "%lu", n);
+  return write(buffer);
+}
+
+size_t Print::print(double n, int digits) {
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, n);
+  return write(buffer);
+}
+
+size_t Print::println() {
+  return write("\r\n");
+}
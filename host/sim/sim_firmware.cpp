@@ -0,0 +1,271 @@
+/*
+ * sim_firmware.cpp - The sketch's drive wiring, for running the firmware in the simulator.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sim.h"
+#include "config.h"
+#include "sio_channel.h"
+#include "disk_device.h"
+#include "sdrive.h"
+#include "disk_drive.h"
+#include "task_scheduler.h"
+
+/*
+ * This follows SIO2Arduino.ino for D1: and the SDrive device (the parts that only deal
+ * with hardware, like the LCD and buttons, are left out), so keep the two in step.
+ */
+static DriveStatus* getDeviceStatus(int deviceId);
+static SectorDataInfo* readSector(int deviceId, unsigned long sector, byte *data);
+static boolean writeSector(int deviceId, unsigned long sector, byte* data, unsigned long length);
+static boolean format(int deviceId, int density);
+static int getFileList(int startIndex, int count, FileEntry *entries);
+static void mountFileIndex(int deviceId, int ix);
+static void changeDirectory(int ix);
+static boolean continueFormat();
+static boolean continueLoad();
+static boolean mountFilename(const char* name);
+#ifdef SECTOR_CACHE
+static boolean writeBackCache();
+static boolean readAheadCache();
+#endif
+
+static DriveAccess driveAccess(getDeviceStatus, readSector, writeSector, format);
+static DriveControl driveControl(getFileList, mountFileIndex, changeDirectory);
+static DiskDevice diskDevice(DEVICE_D1, &driveAccess);
+static SDriveHandler sdriveHandler(&driveControl);
+#ifdef SIO_STATS
+static SIOStats sioStats;
+#endif
+static SIOChannel sioChannel(PIN_ATARI_CMD, &simBus);
+static TaskScheduler scheduler(&sioChannel);
+static SdFat32 card;
+static SdFile currDir;
+static SdFile file;
+static DiskDrive drive1;
+
+void simFirmwareSetup() {
+  #ifdef SIO_STATS
+  sioChannel.setStats(&sioStats);
+  #endif
+  sioChannel.addDevice(&diskDevice);
+  sioChannel.addDevice(&sdriveHandler);
+
+  card.begin(PIN_SD_CS, SD_SCK_MHZ(SD_SPI_MHZ));
+  currDir.open("/");
+}
+
+/**
+ * Mounts an image from the current directory on D1:, indexing it straight away.
+ */
+boolean simFirmwareMount(const char* name) {
+  if (!mountFilename(name)) {
+    return false;
+  }
+  while (!drive1.continueLoad());
+  return drive1.hasImage();
+}
+
+static boolean mountFilename(const char* name) {
+  while (!drive1.continueFormat());
+  #ifdef SECTOR_CACHE
+  drive1.flushCache();
+  #endif
+
+  if (file.isOpen()) {
+    file.close();
+  }
+  if (!file.open(&currDir, name, O_RDWR | O_SYNC)) {
+    #ifdef VDOS_IMAGES
+    // (only a directory, mounted as a virtual DOS disk, is opened read-only)
+    if (!file.open(&currDir, name, O_READ) || !file.isDir()) {
+      file.close();
+      return false;
+    }
+    #else
+    return false;
+    #endif
+  }
+  if (!drive1.setImageFile(&file, &currDir)) {
+    return false;
+  }
+  if (!scheduler.schedule(continueLoad)) {
+    while (!drive1.continueLoad());
+  }
+  return true;
+}
+
+/**
+ * One pass of loop(), followed by the serialEvent() call the core makes after it.
+ */
+void simFirmwareLoop() {
+  simAdvance(SIM_LOOP_TIME);
+
+  sioChannel.runCycle();
+
+  #ifdef SECTOR_CACHE
+  if (drive1.hasDirtySectors()) {
+    scheduler.schedule(writeBackCache);
+  }
+  if (drive1.hasReadAhead()) {
+    scheduler.schedule(readAheadCache);
+  }
+  #endif
+  scheduler.run();
+
+  while (simBus.available()) {
+    sioChannel.processIncomingByte();
+  }
+}
+
+static DriveStatus* getDeviceStatus(int deviceId) {
+  return drive1.getStatus();
+}
+
+static SectorDataInfo* readSector(int deviceId, unsigned long sector, byte *data) {
+  return drive1.hasImage() ? drive1.getSectorData(sector, data) : NULL;
+}
+
+static boolean writeSector(int deviceId, unsigned long sector, byte* data, unsigned long length) {
+  return (drive1.writeSectorData(sector, data, length) == length);
+}
+
+static boolean format(int deviceId, int density) {
+  char name[13];
+
+  file.getName(name, 13);
+  file.close();
+  file.remove();
+  file.open(&currDir, name, O_RDWR | O_SYNC | O_CREAT);
+
+  if (drive1.formatImage(&file, density)) {
+    if (!scheduler.schedule(continueFormat)) {
+      while (!drive1.continueFormat());
+    }
+    return true;
+  }
+  return false;
+}
+
+static boolean continueFormat() {
+  return drive1.continueFormat();
+}
+
+static boolean continueLoad() {
+  return drive1.continueLoad();
+}
+
+#ifdef SECTOR_CACHE
+static boolean writeBackCache() {
+  return drive1.writeBackCache();
+}
+
+static boolean readAheadCache() {
+  return drive1.readAheadCache();
+}
+#endif
+
+static boolean isValidFilename(char *s) {
+  return (  s[0] != '.' &&
+            s[0] != '_' && (
+             (s[8] == 'A' && s[9] == 'T' && s[10] == 'R')
+          || (s[8] == 'X' && s[9] == 'F' && s[10] == 'D')
+#ifdef PRO_IMAGES
+          || (s[8] == 'P' && s[9] == 'R' && s[10] == 'O')
+#endif
+#ifdef ATX_IMAGES
+          || (s[8] == 'A' && s[9] == 'T' && s[10] == 'X')
+#endif
+#ifdef DCM_IMAGES
+          || (s[8] == 'D' && s[9] == 'C' && s[10] == 'M')
+#endif
+#ifdef XEX_IMAGES
+          || (s[8] == 'X' && s[9] == 'E' && s[10] == 'X')
+#endif
+#ifdef VDOS_IMAGES
+          || (s[8] == 'D' && s[9] == 'O' && s[10] == 'S')
+#endif
+          )
+        );
+}
+
+static void createFilename(char* filename, char* name) {
+  for (int i=0; i < 8; i++) {
+    if (name[i] != ' ') {
+      *(filename++) = name[i];
+    }
+  }
+  if (name[8] != ' ') {
+    *(filename++) = '.';
+    *(filename++) = name[8];
+    *(filename++) = name[9];
+    *(filename++) = name[10];
+  }
+  *(filename++) = '\0';
+}
+
+static int getFileList(int startIndex, int count, FileEntry *entries) {
+  DirFat_t dir;
+  int currentEntry = 0;
+
+  currDir.rewind();
+
+  int ix = 0;
+  while (ix < count) {
+    if (currDir.readDir(&dir) < 1) {
+      break;
+    }
+    if (isValidFilename((char*)&dir.name) || (isSubdir(&dir) && dir.name[0] != '.')) {
+      if (currentEntry >= startIndex) {
+        memcpy(entries[ix].name, dir.name, 11);
+        entries[ix].isDirectory = (isSubdir(&dir) && !isValidFilename((char*)&dir.name));
+        ix++;
+      }
+      currentEntry++;
+    }
+  }
+
+  return ix;
+}
+
+static void changeDirectory(int ix) {
+  FileEntry entries[1];
+  char name[13];
+  SdFile subDir;
+
+  if (ix > -1) {
+    getFileList(ix, 1, entries);
+    createFilename(name, entries[0].name);
+    if (subDir.open(&currDir, name, O_READ)) {
+      currDir = subDir;
+    }
+  } else if (subDir.open("/")) {
+    currDir = subDir;
+  }
+}
+
+static void mountFileIndex(int deviceId, int ix) {
+  FileEntry entries[1];
+  char name[13];
+
+  getFileList(ix, 1, entries);
+  createFilename(name, entries[0].name);
+  mountFilename(name);
+}
@@ -0,0 +1,232 @@
+/*
+ * sio2host.c - Serves a disk image to SIO2Arduino (built with HOST_IMAGES) over the
+ * Arduino's USB serial port.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Build (Linux): cc -O2 -o sio2host sio2host.c
+ * Usage:         sio2host [-r] <serial device> <image.atr | image.xfd>
+ *
+ * -r serves the image read-only. Single density (128 byte sector) images only. The
+ * protocol is described in host_drive.h.
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define HOST_REQUEST     0xA5
+#define HOST_REPLY       0x5A
+#define HOST_CMD_HELLO   'H'
+#define HOST_CMD_READ    'R'
+#define HOST_CMD_WRITE   'W'
+#define HOST_STATUS_OK   0
+#define HOST_STATUS_ERR  1
+#define SECTOR_SIZE      128
+#define ATR_HEADER_SIZE  16
+
+static int image;
+static long imageOffset;
+static unsigned int sectorCount;
+static int readOnly;
+
+static unsigned char checksum(const unsigned char* chunk, int length, unsigned char start) {
+  int chkSum = start;
+  for (int i=0; i < length; i++) {
+    chkSum = ((chkSum+chunk[i])>>8) + ((chkSum+chunk[i])&0xff);
+  }
+  return (unsigned char)chkSum;
+}
+
+static int openImage(const char* path) {
+  unsigned char header[ATR_HEADER_SIZE];
+  off_t size;
+
+  image = open(path, readOnly ? O_RDONLY : O_RDWR);
+  if (image < 0) {
+    perror(path);
+    return 0;
+  }
+  size = lseek(image, 0, SEEK_END);
+
+  // an ATR starts with the 0x0296 signature; anything else is taken as a raw XFD
+  imageOffset = 0;
+  if (pread(image, header, sizeof(header), 0) == sizeof(header) && header[0] == 0x96 && header[1] == 0x02) {
+    if (header[4] + (header[5] << 8) != SECTOR_SIZE) {
+      fprintf(stderr, "%s: only single density images are supported\n", path);
+      return 0;
+    }
+    imageOffset = ATR_HEADER_SIZE;
+  }
+  sectorCount = (size - imageOffset) / SECTOR_SIZE;
+  return 1;
+}
+
+static int openPort(const char* path) {
+  struct termios tio;
+  int fd = open(path, O_RDWR | O_NOCTTY);
+
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  if (tcgetattr(fd, &tio) < 0) {
+    perror(path);
+    return -1;
+  }
+  cfmakeraw(&tio);
+  cfsetispeed(&tio, B115200);
+  cfsetospeed(&tio, B115200);
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+  if (tcsetattr(fd, TCSANOW, &tio) < 0) {
+    perror(path);
+    return -1;
+  }
+  return fd;
+}
+
+static int readFully(int fd, unsigned char* buf, int length) {
+  while (length > 0) {
+    ssize_t n = read(fd, buf, length);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    buf += n;
+    length -= n;
+  }
+  return 1;
+}
+
+static void sendReply(int port, unsigned char cmd, unsigned char seq, unsigned char status, const unsigned char* payload, int length) {
+  unsigned char frame[4 + SECTOR_SIZE + 1];
+
+  frame[0] = HOST_REPLY;
+  frame[1] = cmd;
+  frame[2] = seq;
+  frame[3] = status;
+  memcpy(frame + 4, payload, length);
+  frame[4 + length] = checksum(frame + 1, 3 + length, 0);
+
+  if (write(port, frame, 5 + length) != 5 + length) {
+    perror("write");
+  }
+}
+
+static void handleRequest(int port, unsigned char* request, unsigned char* data) {
+  unsigned char cmd = request[0];
+  unsigned char seq = request[1];
+  unsigned int sector = request[2] + (request[3] << 8);
+  unsigned char payload[SECTOR_SIZE];
+  off_t offset = imageOffset + (off_t)(sector - 1) * SECTOR_SIZE;
+
+  memset(payload, 0, sizeof(payload));
+
+  switch (cmd) {
+    case HOST_CMD_HELLO:
+      payload[0] = SECTOR_SIZE & 0xFF;
+      payload[1] = SECTOR_SIZE >> 8;
+      payload[2] = sectorCount & 0xFF;
+      payload[3] = sectorCount >> 8;
+      payload[4] = readOnly ? 0x01 : 0x00;
+      printf("Arduino connected, serving %u sectors%s\n", sectorCount, readOnly ? " (read-only)" : "");
+      sendReply(port, cmd, seq, HOST_STATUS_OK, payload, 5);
+      break;
+    case HOST_CMD_READ:
+      if (sector < 1 || sector > sectorCount || pread(image, payload, SECTOR_SIZE, offset) != SECTOR_SIZE) {
+        memset(payload, 0, sizeof(payload));
+        sendReply(port, cmd, seq, HOST_STATUS_ERR, payload, SECTOR_SIZE);
+      } else {
+        sendReply(port, cmd, seq, HOST_STATUS_OK, payload, SECTOR_SIZE);
+      }
+      break;
+    case HOST_CMD_WRITE:
+      if (readOnly || sector < 1 || sector > sectorCount || pwrite(image, data, SECTOR_SIZE, offset) != SECTOR_SIZE) {
+        sendReply(port, cmd, seq, HOST_STATUS_ERR, NULL, 0);
+      } else {
+        sendReply(port, cmd, seq, HOST_STATUS_OK, NULL, 0);
+      }
+      break;
+  }
+}
+
+int main(int argc, char** argv) {
+  int arg = 1;
+  int port;
+
+  if (arg < argc && strcmp(argv[arg], "-r") == 0) {
+    readOnly = 1;
+    arg++;
+  }
+  if (argc - arg != 2) {
+    fprintf(stderr, "usage: %s [-r] <serial device> <image.atr | image.xfd>\n", argv[0]);
+    return 1;
+  }
+  if (!openImage(argv[arg + 1])) {
+    return 1;
+  }
+  port = openPort(argv[arg]);
+  if (port < 0) {
+    return 1;
+  }
+
+  for (;;) {
+    unsigned char b;
+    unsigned char request[4];
+    unsigned char data[SECTOR_SIZE];
+    unsigned char chkSum;
+
+    // anything outside a request (e.g. the bootloader's chatter after a reset) is skipped
+    if (!readFully(port, &b, 1)) {
+      break;
+    }
+    if (b != HOST_REQUEST) {
+      continue;
+    }
+
+    if (!readFully(port, request, sizeof(request))) {
+      break;
+    }
+    chkSum = checksum(request, sizeof(request), 0);
+    if (request[0] == HOST_CMD_WRITE) {
+      if (!readFully(port, data, sizeof(data))) {
+        break;
+      }
+      chkSum = checksum(data, sizeof(data), chkSum);
+    }
+    if (!readFully(port, &b, 1)) {
+      break;
+    }
+
+    // a bad request is dropped (the Arduino times out and sends it again)
+    if (b == chkSum) {
+      handleRequest(port, request, data);
+    }
+  }
+
+  fprintf(stderr, "serial port closed\n");
+  return 0;
+}
@@ -0,0 +1,404 @@
+/*
+ * sio_bench.cpp - Runs scripted SIO workloads against the firmware, built for a Linux
+ * host, with a simulated SD card, and reports throughput, latency and bus use.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Build (Linux, from the top of the tree, with config.h feature flags other than
+ * MEMORY_PROBE, which reads the AVR's RAM, added as -D):
+ *   g++ -O2 -Ihost/sim -I. -o sio_bench host/sio_bench.cpp host/sim/sim_*.cpp *.cpp
+ * Usage:
+ *   sio_bench [-r <us>] [-w <us>] [-s <us>] [-i <writes>] [-b <us>] [workload...]
+ *
+ * The workloads are boot, copy, random, browse and write (all of them by default). The
+ * options set the simulated card's block read and write times, the extra time for an
+ * access that straddles two blocks and how often (in block writes) and for how long the
+ * card goes busy. Everything runs on the simulator's virtual clock against a generated
+ * image and a 5,000 entry directory, so the same build and options always give the same
+ * numbers.
+*/
+#include <vector>
+#include <algorithm>
+#include "sim.h"
+#include "sio_channel.h"
+#include "disk_device.h"
+#include "sdrive.h"
+
+#define BENCH_IMAGE "BENCH.ATR"
+
+// workloads
+const byte BENCH_BOOT           = 0;  // sequential sector reads from sector 1
+const byte BENCH_COPY           = 1;  // DOS file copy: runs of reads followed by runs of writes
+const byte BENCH_RANDOM         = 2;  // random sector reads with status polls (copy protection checks)
+const byte BENCH_BROWSE         = 3;  // SDrive directory pages through a 5,000 entry directory
+const byte BENCH_BULK_WRITE     = 4;  // sequential sector writes
+const byte BENCH_WORKLOAD_COUNT = 5;
+
+const char* const BENCH_WORKLOAD_NAMES[BENCH_WORKLOAD_COUNT] = { "boot", "copy", "random", "browse", "write" };
+
+// command types, for the latency figures
+const byte BENCH_TYPE_READ      = 0;
+const byte BENCH_TYPE_WRITE     = 1;
+const byte BENCH_TYPE_STATUS    = 2;
+const byte BENCH_TYPE_SDRIVE    = 3;
+const byte BENCH_TYPE_COUNT     = 4;
+
+const char* const BENCH_TYPE_NAMES[BENCH_TYPE_COUNT] = { "read", "write", "status", "sdrive" };
+
+const unsigned int BENCH_OPS        = 720;    // commands per workload
+const byte BENCH_COPY_RUN           = 8;      // sectors per read/write run in the copy workload
+const unsigned long BENCH_SEED      = 2012;   // random workload seed (so runs are repeatable)
+const unsigned int BENCH_SECTORS    = 720;
+const unsigned int BENCH_DIR_SIZE   = 5000;
+
+// the Atari's side of the bus: command line to first byte, last byte to command line
+// release, ACK to data frame, and how long it waits for a byte before giving up
+const unsigned long BENCH_CMD_LEAD  = 1000;
+const unsigned long BENCH_CMD_HOLD  = 800;
+const unsigned long BENCH_DATA_GAP  = 1000;
+const unsigned long BENCH_TIMEOUT   = 3000000;
+
+// response data lengths (checksum not included)
+const unsigned int BENCH_STATUS_LENGTH = sizeof(StatusFrame);
+const unsigned int BENCH_GET20_LENGTH  = 20 * 12 + 1;
+
+static std::vector<unsigned long> latencies[BENCH_TYPE_COUNT];
+static unsigned long errors;
+static unsigned long timeouts;
+
+/**
+ * Runs the firmware until the given time, or until it has written something.
+ */
+static boolean receive(SimByte* b, unsigned long long deadline) {
+  while (!simBus.receive(b)) {
+    if (simNow() >= deadline) {
+      return false;
+    }
+    simFirmwareLoop();
+  }
+  return true;
+}
+
+static void runUntil(unsigned long long time) {
+  while (simNow() < time) {
+    simFirmwareLoop();
+  }
+}
+
+static byte checksum(const byte* data, unsigned int length) {
+  int chkSum = 0;
+  for (unsigned int i=0; i < length; i++) {
+    chkSum = ((chkSum+data[i])>>8) + ((chkSum+data[i])&0xff);
+  }
+  return chkSum;
+}
+
+/**
+ * Sends a block of bytes from the Atari back to back, starting now.
+ */
+static unsigned long long sendFrame(const byte* data, unsigned int length) {
+  unsigned long long time = simNow();
+  for (unsigned int i=0; i < length; i++) {
+    simBus.send(data[i], time);
+    time += simBus.getByteTime();
+  }
+  return time;
+}
+
+/**
+ * Runs one command the way the Atari would and records how long it took, from the
+ * command line going down to the last byte of the response arriving. Sector reads fill
+ * data with the sector; writes send it.
+ */
+static boolean runCommand(byte type, byte deviceId, byte command, unsigned int aux, byte* data, unsigned int length) {
+  unsigned long long start = simNow();
+  CommandFrame frame;
+  SimByte b;
+
+  frame.deviceId = deviceId;
+  frame.command = command;
+  frame.aux1 = aux & 0xff;
+  frame.aux2 = aux >> 8;
+  frame.checksum = checksum((byte*)&frame, 4);
+
+  simBus.setCommandLine(true);
+  runUntil(start + BENCH_CMD_LEAD);
+  unsigned long long end = sendFrame((byte*)&frame, COMMAND_FRAME_SIZE);
+
+  // (the command line has to be released while we wait for the ACK)
+  unsigned long long release = end + BENCH_CMD_HOLD;
+  while (simBus.isCommandAsserted()) {
+    if (simBus.receive(&b)) {
+      break;
+    }
+    if (simNow() >= release) {
+      simBus.setCommandLine(false);
+    } else {
+      simFirmwareLoop();
+    }
+  }
+  if (simBus.isCommandAsserted()) {
+    runUntil(release);
+    simBus.setCommandLine(false);
+  } else if (!receive(&b, simNow() + BENCH_TIMEOUT)) {
+    timeouts++;
+    return false;
+  }
+  if (b.data != ACK) {
+    errors++;
+    return false;
+  }
+
+  if (command == CMD_WRITE) {
+    runUntil(b.end + BENCH_DATA_GAP);
+    sendFrame(data, length);
+    byte chkSum = checksum(data, length);
+    sendFrame(&chkSum, 1);
+    if (!receive(&b, simNow() + BENCH_TIMEOUT)) {
+      timeouts++;
+      return false;
+    }
+    if (b.data != ACK) {
+      errors++;
+      return false;
+    }
+  }
+
+  if (!receive(&b, simNow() + BENCH_TIMEOUT)) {
+    timeouts++;
+    return false;
+  }
+  if (b.data != COMPLETE) {
+    errors++;
+    return false;
+  }
+
+  if (command != CMD_WRITE) {
+    for (unsigned int i=0; i <= length; i++) {
+      if (!receive(&b, simNow() + BENCH_TIMEOUT)) {
+        timeouts++;
+        return false;
+      }
+      if (i < length) {
+        data[i] = b.data;
+      }
+    }
+    // (only sector reads are checked -- GET20's checksum isn't what the Atari expects)
+    if (command == CMD_READ && b.data != checksum(data, length)) {
+      errors++;
+      return false;
+    }
+  }
+
+  latencies[type].push_back(b.end - start);
+  return true;
+}
+
+static unsigned long nextRandom(unsigned long* seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 16) & 0xffff;
+}
+
+static void fillSector(byte* data, unsigned int sector) {
+  for (unsigned int i=0; i < SD_SECTOR_SIZE; i++) {
+    data[i] = (byte)(sector + i);
+  }
+}
+
+/**
+ * Runs the workload's commands, returning how many sectors were moved.
+ */
+static unsigned int runWorkload(byte workload) {
+  byte data[BENCH_GET20_LENGTH];
+  unsigned long seed = BENCH_SEED;
+  unsigned int page = 0;
+  unsigned int sectors = 0;
+
+  for (unsigned int op=0; op < BENCH_OPS; op++) {
+    switch (workload) {
+      case BENCH_BOOT:
+        sectors += runCommand(BENCH_TYPE_READ, DEVICE_D1, CMD_READ, op % BENCH_SECTORS + 1, data, SD_SECTOR_SIZE);
+        break;
+      case BENCH_COPY: {
+        // read a run of sectors from the first half of the disk, then write it to the second
+        unsigned int run = op / BENCH_COPY_RUN;
+        unsigned int n = (run / 2) * BENCH_COPY_RUN + op % BENCH_COPY_RUN;
+        if (run % 2 == 0) {
+          sectors += runCommand(BENCH_TYPE_READ, DEVICE_D1, CMD_READ, 4 + n % 356, data, SD_SECTOR_SIZE);
+        } else {
+          fillSector(data, 400 + n % 320);
+          sectors += runCommand(BENCH_TYPE_WRITE, DEVICE_D1, CMD_WRITE, 400 + n % 320, data, SD_SECTOR_SIZE);
+        }
+        break;
+      }
+      case BENCH_RANDOM:
+        if (op % 4 == 3) {
+          runCommand(BENCH_TYPE_STATUS, DEVICE_D1, CMD_STATUS, 0, data, BENCH_STATUS_LENGTH);
+        } else {
+          sectors += runCommand(BENCH_TYPE_READ, DEVICE_D1, CMD_READ, nextRandom(&seed) % BENCH_SECTORS + 1, data, SD_SECTOR_SIZE);
+        }
+        break;
+      case BENCH_BROWSE:
+        // (wraps around to the start of the directory after the last page)
+        if (runCommand(BENCH_TYPE_SDRIVE, DEVICE_SDRIVE, CMD_SDRIVE_GET20, page, data, BENCH_GET20_LENGTH)) {
+          page = data[BENCH_GET20_LENGTH - 1] ? page + 20 : 0;
+        }
+        break;
+      case BENCH_BULK_WRITE:
+        fillSector(data, op % BENCH_SECTORS + 1);
+        sectors += runCommand(BENCH_TYPE_WRITE, DEVICE_D1, CMD_WRITE, op % BENCH_SECTORS + 1, data, SD_SECTOR_SIZE);
+        break;
+    }
+  }
+  return sectors;
+}
+
+/**
+ * Sets up the card: a single density image to run the disk workloads against and a
+ * directory big enough to page through.
+ */
+static boolean createCard() {
+  std::vector<byte> image(16 + BENCH_SECTORS * SD_SECTOR_SIZE);
+  unsigned long paragraphs = BENCH_SECTORS * SD_SECTOR_SIZE / 16;
+  image[0] = 0x96;
+  image[1] = 0x02;
+  image[2] = paragraphs & 0xff;
+  image[3] = (paragraphs >> 8) & 0xff;
+  image[4] = SD_SECTOR_SIZE & 0xff;
+  image[5] = SD_SECTOR_SIZE >> 8;
+  for (unsigned int s=1; s <= BENCH_SECTORS; s++) {
+    fillSector(&image[16 + (s - 1) * SD_SECTOR_SIZE], s);
+  }
+  if (!simCardAddFile(BENCH_IMAGE, &image[0], image.size())) {
+    return false;
+  }
+
+  for (unsigned int i=0; i < BENCH_DIR_SIZE; i++) {
+    char name[13];
+    snprintf(name, sizeof(name), "G%04u.ATR", i);
+    if (!simCardAddFile(name, &image[0], 16)) {
+      return false;
+    }
+  }
+
+  simFirmwareSetup();
+  return simFirmwareMount(BENCH_IMAGE);
+}
+
+static unsigned long percentile(std::vector<unsigned long>& values, byte pct) {
+  unsigned int ix = (values.size() * pct + 99) / 100;
+  return values[ix ? ix - 1 : 0];
+}
+
+static void report(byte workload, unsigned int sectors, unsigned long long elapsed, unsigned long long busy, SimCardStats* card) {
+  unsigned long ms = elapsed / 1000;
+  unsigned long busyMs = busy / 1000;
+
+  printf("%s: %u commands, %u sectors in %lu ms (%.1f sectors/s)\n", BENCH_WORKLOAD_NAMES[workload],
+    BENCH_OPS, sectors, ms, ms ? (float)sectors * 1000 / ms : 0);
+
+  for (byte t=0; t < BENCH_TYPE_COUNT; t++) {
+    std::vector<unsigned long>& values = latencies[t];
+    if (values.empty()) {
+      continue;
+    }
+    std::sort(values.begin(), values.end());
+    printf("  %-7s %4u commands, latency (us): p50 %lu, p90 %lu, p99 %lu, max %lu\n", BENCH_TYPE_NAMES[t],
+      (unsigned int)values.size(), percentile(values, 50), percentile(values, 90), percentile(values, 99), values.back());
+  }
+
+  // (the bus is half duplex, so it's idle whenever neither side is sending)
+  unsigned long idleMs = (busyMs < ms) ? ms - busyMs : 0;
+  printf("  UART: %lu ms busy, %lu ms idle (%lu%%)\n", busyMs, idleMs, ms ? idleMs * 100 / ms : 0);
+  printf("  card: %lu block reads, %lu block writes, %lu busy periods, %lu ms waiting\n",
+    card->blockReads, card->blockWrites, card->busyPeriods, (unsigned long)(card->time / 1000));
+  printf("  errors: %lu, timeouts: %lu\n", errors, timeouts);
+}
+
+int main(int argc, char** argv) {
+  SimCardModel model = SIM_DEFAULT_CARD;
+  boolean selected[BENCH_WORKLOAD_COUNT];
+  boolean any = false;
+
+  memset(selected, 0, sizeof(selected));
+  for (int i=1; i < argc; i++) {
+    if (argv[i][0] == '-' && i + 1 < argc) {
+      unsigned long value = strtoul(argv[++i], NULL, 10);
+      switch (argv[i - 1][1]) {
+        case 'r':
+          model.readLatency = value;
+          break;
+        case 'w':
+          model.writeLatency = value;
+          break;
+        case 's':
+          model.straddlePenalty = value;
+          break;
+        case 'i':
+          model.busyInterval = value;
+          break;
+        case 'b':
+          model.busyTime = value;
+          break;
+        default:
+          fprintf(stderr, "unknown option %s\n", argv[i - 1]);
+          return 1;
+      }
+      continue;
+    }
+
+    byte w = 0;
+    while (w < BENCH_WORKLOAD_COUNT && strcmp(argv[i], BENCH_WORKLOAD_NAMES[w]) != 0) {
+      w++;
+    }
+    if (w == BENCH_WORKLOAD_COUNT) {
+      fprintf(stderr, "usage: %s [-r <us>] [-w <us>] [-s <us>] [-i <writes>] [-b <us>] [boot|copy|random|browse|write...]\n", argv[0]);
+      return 1;
+    }
+    selected[w] = true;
+    any = true;
+  }
+
+  // (setting up the card isn't part of any measurement)
+  simCardSetModel(&model);
+  if (!createCard()) {
+    fprintf(stderr, "unable to set up the simulated card\n");
+    return 1;
+  }
+
+  for (byte w=0; w < BENCH_WORKLOAD_COUNT; w++) {
+    if (any && !selected[w]) {
+      continue;
+    }
+
+    for (byte t=0; t < BENCH_TYPE_COUNT; t++) {
+      latencies[t].clear();
+    }
+    errors = 0;
+    timeouts = 0;
+    memset(simCardGetStats(), 0, sizeof(SimCardStats));
+    unsigned long long start = simNow();
+    unsigned long long busy = simBus.getBusyTime();
+
+    unsigned int sectors = runWorkload(w);
+    report(w, sectors, simNow() - start, simBus.getBusyTime() - busy, simCardGetStats());
+  }
+  return 0;
+}
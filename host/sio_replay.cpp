@@ -0,0 +1,247 @@
+/*
+ * sio_replay.cpp - Replays an SIO bus trace (recorded with SIO_SNIFFER) against the
+ * firmware, built for a Linux host, and checks its responses byte for byte and gap for gap.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * Build (Linux, from the top of the tree, with config.h feature flags other than
+ * MEMORY_PROBE, which reads the AVR's RAM, added as -D):
+ *   g++ -O2 -Ihost/sim -I. -o sio_replay host/sio_replay.cpp host/sim/sim_*.cpp *.cpp
+ * Usage:
+ *   sio_replay [-t <us>] <SIOTRACE.BIN> <image>
+ *
+ * The image is copied into the simulated card and mounted on D1:, so the replay never
+ * changes it. The Atari's bytes are sent with their recorded spacing, measured from
+ * whatever preceded them in the trace (so a slower or faster response shifts everything
+ * after it rather than the two sides drifting apart), and the command line is held down
+ * around each command frame. Each response byte has to match the trace, and the gap before it has to be
+ * within -t microseconds of the recorded one (1000 by default).
+ *
+ * The exit status is 0 if everything matched, 1 if a byte didn't and 2 if only the
+ * timing was off.
+*/
+#include <vector>
+#include "sim.h"
+#include "sio_sniffer.h"
+#include "sio_channel.h"
+
+// the trace's records as the AVR lays them out: a 4 byte time, the byte and its flags
+const byte TRACE_RECORD_SIZE        = 6;
+const unsigned int TRACE_BLOCK_SIZE = 512;
+
+// the command line goes low this long before a command frame's first byte starts and
+// high this long after its last byte (the SIO spec allows 650-950us)
+const unsigned long REPLAY_CMD_LEAD   = 1000;
+const unsigned long REPLAY_CMD_HOLD   = 800;
+// how long past its recorded time to wait for a response byte
+const unsigned long REPLAY_OUT_WAIT   = 100000;
+const unsigned long REPLAY_TOLERANCE  = 1000;
+// how many mismatches are listed
+const byte REPLAY_MAX_LISTED          = 10;
+
+struct TraceRecord {
+  unsigned long long  time;
+  byte                data;
+  byte                flags;
+};
+
+static std::vector<TraceRecord> trace;
+static std::vector<SimByte> output;
+static unsigned long long cmdReleaseTime = 0;
+static byte cmdFrameBytes = 0;
+
+/**
+ * Reads a trace file. The AVR's times wrap every 71 minutes, so they're unwrapped here.
+ */
+static boolean loadTrace(const char* path) {
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return false;
+  }
+
+  byte block[TRACE_BLOCK_SIZE];
+  uint32_t lastTime = 0;
+  unsigned long long time = 0;
+  while (fread(block, 1, sizeof(block), f) == sizeof(block)) {
+    unsigned int count = block[0] + (block[1] << 8);
+    for (unsigned int i=0; i < count && i < SNIFFER_RECORDS_PER_BLOCK; i++) {
+      byte* r = block + 2 + i * TRACE_RECORD_SIZE;
+      uint32_t t = r[0] + (r[1] << 8) + (r[2] << 16) + ((uint32_t)r[3] << 24);
+      time = trace.empty() ? t : time + (uint32_t)(t - lastTime);
+      lastTime = t;
+
+      TraceRecord record = { time, r[4], r[5] };
+      trace.push_back(record);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+/**
+ * Copies the image into the simulated card under an 8.3 version of its name (the
+ * extension decides the format) and mounts it.
+ */
+static boolean mountImage(const char* path) {
+  const char* base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  const char* extension = strrchr(base, '.');
+  char name[13];
+
+  unsigned int length = extension ? extension - base : strlen(base);
+  snprintf(name, sizeof(name), "%.*s%s%.3s", min(length, 8U), base, extension ? "." : "", extension ? extension + 1 : "");
+
+  simFirmwareSetup();
+  if (!simCardLoadFile(name, path)) {
+    perror(path);
+    return false;
+  }
+  if (!simFirmwareMount(name)) {
+    fprintf(stderr, "%s: not a usable image\n", path);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Runs the firmware until the given time, or until it has written something if
+ * stopOnOutput is set, releasing the command line when it's due.
+ */
+static void runUntil(unsigned long long time, boolean stopOnOutput) {
+  while (simNow() < time) {
+    if (cmdReleaseTime && simNow() >= cmdReleaseTime) {
+      simBus.setCommandLine(false);
+      cmdReleaseTime = 0;
+    }
+
+    simFirmwareLoop();
+
+    SimByte b;
+    while (simBus.receive(&b)) {
+      output.push_back(b);
+    }
+    if (stopOnOutput && !output.empty()) {
+      return;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  unsigned long tolerance = REPLAY_TOLERANCE;
+  int arg = 1;
+
+  if (arg + 1 < argc && strcmp(argv[arg], "-t") == 0) {
+    tolerance = strtoul(argv[arg + 1], NULL, 10);
+    arg += 2;
+  }
+  if (argc - arg != 2) {
+    fprintf(stderr, "usage: %s [-t <us>] <trace> <image>\n", argv[0]);
+    return 1;
+  }
+  if (!loadTrace(argv[arg]) || !mountImage(argv[arg + 1])) {
+    return 1;
+  }
+  if (trace.empty()) {
+    fprintf(stderr, "%s: empty trace\n", argv[arg]);
+    return 1;
+  }
+
+  // each record's time in the replay, once it's happened
+  std::vector<unsigned long long> replayTime(trace.size());
+  unsigned long bytesOut = 0;
+  unsigned long mismatches = 0;
+  unsigned long lateGaps = 0;
+  long minDelta = 0;
+  long maxDelta = 0;
+
+  // (a moment to settle, as if the Arduino had just started)
+  unsigned long long start = simNow() + REPLAY_CMD_LEAD + simBus.getByteTime();
+
+  for (unsigned int i=0; i < trace.size(); i++) {
+    TraceRecord* r = &trace[i];
+    unsigned long long due = i ? replayTime[i - 1] + (r->time - trace[i - 1].time) : start;
+
+    if (!(r->flags & SNIFFER_FLAG_OUT)) {
+      // the byte has to have arrived when it was recorded, so it goes on the wire a byte
+      // time earlier (and the command line goes down before a command frame)
+      unsigned long long sendTime = max(due, simNow() + simBus.getByteTime()) - simBus.getByteTime();
+      if ((r->flags & SNIFFER_FLAG_CMD) && !simBus.isCommandAsserted()) {
+        runUntil(sendTime - min(sendTime, (unsigned long long)REPLAY_CMD_LEAD), false);
+        simBus.setCommandLine(true);
+        cmdReleaseTime = 0;
+        cmdFrameBytes = 0;
+      }
+      runUntil(sendTime, false);
+      simBus.send(r->data, sendTime);
+      replayTime[i] = sendTime + simBus.getByteTime();
+
+      // (bytes are stamped when they're read, so the last one of a frame may be missing
+      // its command flag -- the line is released after a whole frame instead)
+      if (simBus.isCommandAsserted() && !cmdReleaseTime && ++cmdFrameBytes == COMMAND_FRAME_SIZE) {
+        cmdReleaseTime = replayTime[i] + REPLAY_CMD_HOLD;
+      }
+      continue;
+    }
+
+    // a response byte: wait for the firmware to write it
+    bytesOut++;
+    if (output.empty()) {
+      runUntil(due + REPLAY_OUT_WAIT, true);
+    }
+    if (output.empty()) {
+      if (mismatches++ < REPLAY_MAX_LISTED) {
+        printf("record %u: expected %02X, got nothing\n", i, r->data);
+      }
+      replayTime[i] = due;
+      continue;
+    }
+
+    SimByte b = output.front();
+    output.erase(output.begin());
+    replayTime[i] = b.time;
+
+    if (b.data != r->data && mismatches++ < REPLAY_MAX_LISTED) {
+      printf("record %u: expected %02X, got %02X\n", i, r->data, b.data);
+    }
+
+    long delta = (long)(b.time - due);
+    minDelta = min(minDelta, delta);
+    maxDelta = max(maxDelta, delta);
+    if ((unsigned long)labs(delta) > tolerance) {
+      lateGaps++;
+    }
+  }
+
+  // anything the firmware sent beyond the end of the trace
+  runUntil(simNow() + REPLAY_OUT_WAIT, false);
+  if (!output.empty()) {
+    printf("%u bytes sent after the end of the trace\n", (unsigned int)output.size());
+    mismatches += output.size();
+  }
+
+  printf("%u records, %lu response bytes: %lu mismatched, %lu gaps off by more than %lu us\n",
+    (unsigned int)trace.size(), bytesOut, mismatches, lateGaps, tolerance);
+  printf("response gaps vs. trace: %ld to %ld us\n", minDelta, maxDelta);
+
+  if (mismatches) {
+    return 1;
+  }
+  return lateGaps ? 2 : 0;
+}
@@ -0,0 +1,313 @@
+/*
+ * host_drive.cpp - Serves a drive from a disk image on a host computer.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "host_drive.h"
+#include "sio_device.h"
+#include "config.h"
+
+#ifdef HOST_IMAGES
+
+HostDrive::HostDrive(Stream* stream) {
+  m_stream = stream;
+  m_enabled = false;
+  m_attached = false;
+  m_sectorCount = 0;
+  m_sequence = 0;
+  m_pendingCmd = 0;
+  m_readySector = 0;
+  m_prefetchSector = 0;
+  m_rxState = HOST_RX_START;
+
+  memset(&m_driveStatus, 0, sizeof(m_driveStatus));
+  m_driveStatus.statusFrame.timeout_lsb = 0xE0;
+  m_driveStatus.sectorSize = SD_SECTOR_SIZE;
+
+  memset(&m_sectorInfo, 0, sizeof(m_sectorInfo));
+  m_sectorInfo.length = SD_SECTOR_SIZE;
+}
+
+/**
+ * Starts looking for a host (and waits briefly for one that's already there).
+ */
+void HostDrive::begin() {
+  m_enabled = true;
+  sendRequest(HOST_CMD_HELLO, 0, NULL);
+  finishRequest();
+}
+
+/**
+ * Stops using the host (e.g. because an image was mounted from the card) until the
+ * next reset.
+ */
+void HostDrive::detach() {
+  if (m_pendingCmd) {
+    finishRequest();
+  }
+  m_enabled = false;
+  m_attached = false;
+}
+
+boolean HostDrive::hasImage() {
+  return m_attached;
+}
+
+DriveStatus* HostDrive::getStatus() {
+  return &m_driveStatus;
+}
+
+SectorDataInfo* HostDrive::getSectorData(unsigned long sector, byte* data) {
+  // the sector may already have been prefetched (or be on its way)
+  if (m_pendingCmd) {
+    finishRequest();
+  }
+  if (m_readySector != sector && !transact(HOST_CMD_READ, sector, NULL)) {
+    return NULL;
+  }
+
+  m_sectorInfo.error = (m_readySector != sector);
+  if (m_sectorInfo.error) {
+    memset(data, 0, SD_SECTOR_SIZE);
+  } else {
+    memcpy(data, m_reply, SD_SECTOR_SIZE);
+  }
+  m_readySector = 0;
+
+  // service() asks for the next sector once the data frame has gone out
+  m_prefetchSector = (sector < m_sectorCount) ? sector + 1 : 0;
+
+  return &m_sectorInfo;
+}
+
+unsigned long HostDrive::writeSectorData(unsigned long sector, byte* data, unsigned long len) {
+  if (m_pendingCmd) {
+    finishRequest();
+  }
+  // (a prefetched copy of the sector would be stale now)
+  m_readySector = 0;
+  m_prefetchSector = 0;
+
+  if (!m_attached || m_driveStatus.statusFrame.commandStatus.writeProtect || len != SD_SECTOR_SIZE) {
+    return 0;
+  }
+
+  if (transact(HOST_CMD_WRITE, sector, data) && m_replyStatus == HOST_STATUS_OK) {
+    return len;
+  }
+  return 0;
+}
+
+/**
+ * Takes in reply bytes as they arrive and, while the SIO bus is idle, sends the prefetch
+ * request (or looks for a host). This should be called from loop() so replies never
+ * overflow the serial receive buffer.
+ */
+void HostDrive::service(boolean idle) {
+  if (m_pendingCmd) {
+    // (a lost prefetch just means the sector gets asked for again)
+    if (!receive() || (m_pendingCmd && millis() - m_requestTime > HOST_REPLY_TIMEOUT)) {
+      m_pendingCmd = 0;
+      m_rxState = HOST_RX_START;
+    }
+    return;
+  }
+
+  if (!idle || !m_enabled) {
+    return;
+  }
+
+  if (m_attached) {
+    if (m_prefetchSector) {
+      sendRequest(HOST_CMD_READ, m_prefetchSector, NULL);
+      m_prefetchSector = 0;
+    }
+  } else if (millis() - m_requestTime > HOST_HELLO_INTERVAL) {
+    sendRequest(HOST_CMD_HELLO, 0, NULL);
+  }
+}
+
+/**
+ * Sends a request and waits for its reply, retrying a few times before giving up on
+ * the host.
+ */
+boolean HostDrive::transact(byte cmd, unsigned long sector, byte* data) {
+  for (byte i=0; i < HOST_RETRIES; i++) {
+    sendRequest(cmd, sector, data);
+    if (finishRequest()) {
+      return true;
+    }
+  }
+
+  LOG_MSG_CR(F("Host not answering"));
+  m_attached = false;
+  return false;
+}
+
+void HostDrive::sendRequest(byte cmd, unsigned long sector, byte* data) {
+  byte header[4] = {cmd, ++m_sequence, (byte)(sector & 0xFF), (byte)(sector >> 8)};
+  byte chkSum = SIODevice::checksum(header, sizeof(header));
+
+  // (whatever is left of an earlier reply can only get in the way of this one's)
+  while (m_stream->available() > 0) {
+    m_stream->read();
+  }
+  m_rxState = HOST_RX_START;
+
+  m_stream->write(HOST_REQUEST);
+  m_stream->write(header, sizeof(header));
+  if (data) {
+    m_stream->write(data, SD_SECTOR_SIZE);
+    chkSum = SIODevice::checksum(data, SD_SECTOR_SIZE, chkSum);
+  }
+  m_stream->write(chkSum);
+
+  m_pendingCmd = cmd;
+  m_pendingSector = sector;
+  m_requestTime = millis();
+}
+
+/**
+ * Waits for the reply to the request in flight. Returns false if the host didn't answer
+ * (or its reply had to be dropped).
+ */
+boolean HostDrive::finishRequest() {
+  while (m_pendingCmd) {
+    if (!receive() || (m_pendingCmd && millis() - m_requestTime > HOST_REPLY_TIMEOUT)) {
+      m_pendingCmd = 0;
+      m_rxState = HOST_RX_START;
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Parses whatever reply bytes have arrived. Returns false if the reply overran the
+ * receive buffer and was dropped.
+ */
+boolean HostDrive::receive() {
+  #ifndef ARDUINO_TEENSY
+  // (the Teensy's USB serial port is flow controlled, so it never drops anything)
+  if (m_stream->available() >= HOST_RX_BUFFER_SIZE - 1) {
+    dropReply();
+    return false;
+  }
+  #endif
+
+  while (m_pendingCmd && m_stream->available() > 0) {
+    byte b = m_stream->read();
+
+    switch (m_rxState) {
+      case HOST_RX_START:
+        if (b == HOST_REPLY) {
+          m_rxPos = 0;
+          m_rxState = HOST_RX_HEADER;
+        }
+        break;
+      case HOST_RX_HEADER:
+        m_rxHeader[m_rxPos++] = b;
+        if (m_rxPos == sizeof(m_rxHeader)) {
+          m_rxPos = 0;
+          m_rxLength = getPayloadLength(m_rxHeader[0]);
+          m_rxState = m_rxLength ? HOST_RX_PAYLOAD : HOST_RX_CHECKSUM;
+        }
+        break;
+      case HOST_RX_PAYLOAD:
+        m_reply[m_rxPos++] = b;
+        if (m_rxPos == m_rxLength) {
+          m_rxState = HOST_RX_CHECKSUM;
+        }
+        break;
+      case HOST_RX_CHECKSUM: {
+        m_rxState = HOST_RX_START;
+        byte chkSum = SIODevice::checksum(m_rxHeader, sizeof(m_rxHeader));
+        chkSum = SIODevice::checksum(m_reply, m_rxLength, chkSum);
+        // (anything else is noise or the reply to a request that timed out)
+        if (b == chkSum && m_rxHeader[0] == m_pendingCmd && m_rxHeader[1] == m_sequence) {
+          completeRequest(m_rxHeader[2]);
+        }
+        break;
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Throws away a reply that overran the receive buffer, including the part of it that's
+ * still on its way (the host sends a reply in one go, so it's over once the link goes
+ * quiet).
+ */
+void HostDrive::dropReply() {
+  unsigned long last = micros();
+  while (micros() - last < HOST_QUIET_TIME) {
+    if (m_stream->available() > 0) {
+      m_stream->read();
+      last = micros();
+    }
+  }
+  m_rxState = HOST_RX_START;
+  LOG_MSG_CR(F("Host reply overrun"));
+}
+
+void HostDrive::completeRequest(byte status) {
+  m_replyStatus = status;
+
+  switch (m_pendingCmd) {
+    case HOST_CMD_HELLO:
+      // only single density images fit the sector buffer
+      if (status == HOST_STATUS_OK && m_reply[0] == SD_SECTOR_SIZE && m_reply[1] == 0) {
+        m_sectorCount = m_reply[2] + (m_reply[3] << 8);
+        m_driveStatus.sectorCount = m_sectorCount;
+        memset(&m_driveStatus.statusFrame, 0, sizeof(m_driveStatus.statusFrame));
+        m_driveStatus.statusFrame.timeout_lsb = 0xE0;
+        if (m_reply[4] & HOST_FLAG_READ_ONLY) {
+          m_driveStatus.statusFrame.commandStatus.writeProtect = 1;
+        } else {
+          m_driveStatus.statusFrame.hardwareStatus.writeProtect = 1;
+        }
+        m_readySector = 0;
+        m_prefetchSector = 0;
+        m_attached = true;
+        LOG_MSG(F("Host image attached, sectors: "));
+        LOG_MSG_CR(m_sectorCount);
+      }
+      break;
+    case HOST_CMD_READ:
+      m_readySector = (status == HOST_STATUS_OK) ? m_pendingSector : 0;
+      break;
+  }
+
+  m_pendingCmd = 0;
+}
+
+byte HostDrive::getPayloadLength(byte cmd) {
+  switch (cmd) {
+    case HOST_CMD_HELLO:
+      return HOST_HELLO_SIZE;
+    case HOST_CMD_READ:
+      return SD_SECTOR_SIZE;
+    default:
+      return 0;
+  }
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef HOST_DRIVE_h
+#define HOST_DRIVE_h
+
+#include <Arduino.h>
+#include "atari.h"
+
+/*
+ * The host link protocol. Every request gets one reply, and only one request is ever
+ * in flight. 16-bit values are little-endian and checksums are SIO checksums of
+ * everything between the start byte and the checksum.
+ *
+ *   request: 0xA5, command, sequence, sector lo, sector hi, [128 data bytes for a write], checksum
+ *   reply:   0x5A, command, sequence, status, [payload], checksum
+ *
+ * A hello reply's payload is the sector size, the sector count and a flags byte (bit 0
+ * set if the image is read-only); a read reply's payload is the sector (zeros if the
+ * status isn't 0); a write reply has none.
+ */
+const byte HOST_REQUEST              = 0xA5;
+const byte HOST_REPLY                = 0x5A;
+
+const byte HOST_CMD_HELLO            = 'H';
+const byte HOST_CMD_READ             = 'R';
+const byte HOST_CMD_WRITE            = 'W';
+
+const byte HOST_STATUS_OK            = 0;
+const byte HOST_FLAG_READ_ONLY       = 0x01;
+const byte HOST_HELLO_SIZE           = 5;
+
+// how long to wait for a reply, and how many times a request is sent before deciding
+// the host has gone away
+const unsigned long HOST_REPLY_TIMEOUT   = 250;
+const byte HOST_RETRIES                  = 3;
+// how often to look for a host while there isn't one
+const unsigned long HOST_HELLO_INTERVAL  = 2000;
+// the serial receive buffer (HardwareSerial's SERIAL_RX_BUFFER_SIZE, which holds one
+// byte less) -- finding it full means part of a reply may have been dropped
+const byte HOST_RX_BUFFER_SIZE           = 64;
+// how long the link has to be quiet before the rest of a dropped reply is over (us)
+const unsigned long HOST_QUIET_TIME      = 2000;
+
+// reply parser states
+const byte HOST_RX_START             = 0;
+const byte HOST_RX_HEADER            = 1;
+const byte HOST_RX_PAYLOAD           = 2;
+const byte HOST_RX_CHECKSUM          = 3;
+
+/**
+ * A drive whose image lives on a host computer and is read and written over a serial
+ * link (see host/sio2host.c). After a sector is read, the next one is requested as soon
+ * as the SIO bus goes idle, so the round trip to the host overlaps the Atari processing
+ * the sector and sending its next command. A reply that arrives while the firmware is
+ * busy with the SIO bus can overrun the receive buffer; it's dropped, and the sector is
+ * asked for again.
+ */
+class HostDrive {
+public:
+  HostDrive(Stream* stream);
+  void begin();
+  void detach();
+  boolean hasImage();
+  DriveStatus* getStatus();
+  SectorDataInfo* getSectorData(unsigned long sector, byte* data);
+  unsigned long writeSectorData(unsigned long sector, byte* data, unsigned long len);
+  void service(boolean idle);
+private:
+  boolean transact(byte cmd, unsigned long sector, byte* data);
+  void sendRequest(byte cmd, unsigned long sector, byte* data);
+  boolean finishRequest();
+  boolean receive();
+  void dropReply();
+  void completeRequest(byte status);
+  byte getPayloadLength(byte cmd);
+
+  Stream*         m_stream;
+  boolean         m_enabled;
+  boolean         m_attached;
+  unsigned int    m_sectorCount;
+  DriveStatus     m_driveStatus;
+  SectorDataInfo  m_sectorInfo;
+  byte            m_sequence;
+  byte            m_pendingCmd;
+  unsigned long   m_pendingSector;
+  unsigned long   m_requestTime;
+  unsigned long   m_readySector;
+  unsigned long   m_prefetchSector;
+  byte            m_replyStatus;
+  byte            m_rxState;
+  byte            m_rxPos;
+  byte            m_rxLength;
+  byte            m_rxHeader[3];
+  byte            m_reply[MAX_SECTOR_SIZE];
+};
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * image_copier.cpp - Duplicates image files on the SD card in the background.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "image_copier.h"
+#include "config.h"
+
+#ifdef IMAGE_COPY
+
+ImageCopier::ImageCopier(SdFile* dir) {
+  m_dir = dir;
+  m_state = COPY_IDLE;
+  m_copied = 0;
+  m_total = 0;
+  m_sourceName[0] = 0;
+  m_targetName[0] = 0;
+}
+
+/**
+ * Queues a copy of the file with the given (space padded, 11 character) directory entry
+ * name. Returns false if a copy is already under way.
+ */
+boolean ImageCopier::start(char* dosName) {
+  if (isBusy()) {
+    return false;
+  }
+
+  // build the 8.3 name
+  char* name = m_sourceName;
+  for (byte i=0; i < 8 && dosName[i] != ' '; i++) {
+    *(name++) = dosName[i];
+  }
+  if (dosName[8] != ' ') {
+    *(name++) = '.';
+    for (byte i=8; i < 11 && dosName[i] != ' '; i++) {
+      *(name++) = dosName[i];
+    }
+  }
+  *name = 0;
+
+  m_targetName[0] = 0;
+  m_copied = 0;
+  m_total = 0;
+  m_state = COPY_STARTING;
+  return true;
+}
+
+boolean ImageCopier::isBusy() {
+  return (m_state == COPY_STARTING || m_state == COPY_RUNNING);
+}
+
+/**
+ * Returns true until the copy's first slice has opened the files.
+ */
+boolean ImageCopier::isStarting() {
+  return (m_state == COPY_STARTING);
+}
+
+/**
+ * Background task that opens the files on its first slice and then copies a chunk per
+ * slice. Returns true when the copy has finished (or failed).
+ */
+boolean ImageCopier::run() {
+  if (m_state == COPY_STARTING) {
+    if (!open()) {
+      finish(COPY_FAILED);
+    }
+    return !isBusy();
+  }
+  if (m_state != COPY_RUNNING) {
+    return true;
+  }
+
+  // (the chunk is kept in the copier, so a slice doesn't need half a K of stack)
+  int n = m_source.read(m_buffer, sizeof(m_buffer));
+  // (running out early means the original shrank under us)
+  if (n <= 0 || m_target.write(m_buffer, n) != (size_t)n) {
+    finish(COPY_FAILED);
+    return true;
+  }
+
+  m_copied += n;
+  if (m_copied >= m_total) {
+    finish(COPY_DONE);
+  }
+  return !isBusy();
+}
+
+void ImageCopier::getFrame(CopyFrame* frame) {
+  memset(frame, 0, sizeof(CopyFrame));
+  frame->state = m_state;
+  frame->percent = m_total ? (m_copied * 100) / m_total : (m_state == COPY_DONE ? 100 : 0);
+  frame->copied = m_copied;
+  frame->total = m_total;
+  memcpy(frame->name, m_targetName, min(strlen(m_targetName), sizeof(frame->name)));
+}
+
+boolean ImageCopier::open() {
+  if (!m_source.open(m_dir, m_sourceName, O_READ)) {
+    return false;
+  }
+  // (a directory mounted as a virtual DOS disk can't be copied this way)
+  if (m_source.isDir() || !createTarget()) {
+    m_source.close();
+    return false;
+  }
+
+  m_total = m_source.fileSize();
+
+  // a contiguous file can be written a run of blocks at a time without SdFat having to
+  // go back to the FAT between them; a fragmented card just makes for a slower copy
+  if (m_total && !m_target.preAllocate(m_total)) {
+    LOG_MSG_CR(F("Copy isn't contiguous"));
+  }
+
+  LOG_MSG(F("Copying "));
+  LOG_MSG(m_sourceName);
+  LOG_MSG(F(" to "));
+  LOG_MSG_CR(m_targetName);
+
+  m_state = COPY_RUNNING;
+  if (!m_total) {
+    finish(COPY_DONE);
+  }
+  return true;
+}
+
+/**
+ * Creates the copy under the first free name: the original's name (cut down to 6
+ * characters) with _A to _Z added.
+ */
+boolean ImageCopier::createTarget() {
+  char* extension = strchr(m_sourceName, '.');
+  byte baseLength = extension ? extension - m_sourceName : strlen(m_sourceName);
+  if (baseLength > 6) {
+    baseLength = 6;
+  }
+
+  memcpy(m_targetName, m_sourceName, baseLength);
+  m_targetName[baseLength] = '_';
+  m_targetName[baseLength + 1] = 'A';
+  m_targetName[baseLength + 2] = 0;
+  if (extension) {
+    strcat(m_targetName, extension);
+  }
+
+  for (char c='A'; c <= 'Z'; c++) {
+    m_targetName[baseLength + 1] = c;
+    if (m_target.open(m_dir, m_targetName, O_RDWR | O_CREAT | O_EXCL)) {
+      return true;
+    }
+  }
+
+  m_targetName[0] = 0;
+  return false;
+}
+
+void ImageCopier::finish(byte state) {
+  m_source.close();
+  if (m_target.isOpen()) {
+    if (state == COPY_DONE) {
+      m_target.close();
+    } else {
+      // (a partial copy is no use to anyone)
+      m_target.remove();
+      m_target.close();
+    }
+  }
+
+  LOG_MSG(F("Copy "));
+  LOG_MSG_CR(state == COPY_DONE ? F("done") : F("failed"));
+  m_state = state;
+}
+
+#endif
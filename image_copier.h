@@ -0,0 +1,58 @@
+#ifndef IMAGE_COPIER_h
+#define IMAGE_COPIER_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+// how much is copied per background slice (a whole card block, so SdFat moves it
+// straight between the card and the buffer instead of through its block cache)
+const unsigned int COPY_CHUNK_SIZE   = 512;
+
+// copy states
+const byte COPY_IDLE                 = 0;
+const byte COPY_STARTING             = 1;
+const byte COPY_RUNNING              = 2;
+const byte COPY_DONE                 = 3;
+const byte COPY_FAILED               = 4;
+
+// SDrive copy status command response (little-endian; fixed width and packed, so a host
+// build sends the same 22 bytes)
+struct CopyFrame {
+  byte state;
+  byte percent;
+  uint32_t copied;
+  uint32_t total;
+  char name[12];               // the copy's file name (zero padded)
+} __attribute__((packed));
+
+/**
+ * Duplicates an image file in the current directory as a background job. The copy is
+ * named after the original with _A, _B, ... added (e.g. GAME.ATR -> GAME_A.ATR) and is
+ * allocated in one contiguous run up front when the card has room for that, so the
+ * copy itself is nothing but whole-block reads and writes.
+ */
+class ImageCopier {
+public:
+  ImageCopier(SdFile* dir);
+  boolean start(char* dosName);
+  boolean isBusy();
+  boolean isStarting();
+  boolean run();
+  void getFrame(CopyFrame* frame);
+private:
+  boolean open();
+  boolean createTarget();
+  void finish(byte state);
+
+  SdFile*        m_dir;
+  SdFile         m_source;
+  SdFile         m_target;
+  byte           m_state;
+  unsigned long  m_copied;
+  unsigned long  m_total;
+  char           m_sourceName[13];
+  char           m_targetName[13];
+  byte           m_buffer[COPY_CHUNK_SIZE];
+};
+
+#endif
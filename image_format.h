@@ -0,0 +1,21 @@
+#ifndef IMAGE_FORMAT_h
+#define IMAGE_FORMAT_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include "atari.h"
+#include "config.h"
+
+#define SECTOR_SIZE_SD  128
+
+// what a step of an index built in the background (over several calls, so a mount
+// doesn't hold up the SIO bus) comes back with
+#define INDEX_RUNNING   0
+#define INDEX_DONE      1
+#define INDEX_FAILED    2
+
+// reads a sector from the current file position (anything past the end of the file
+// reads as 0)
+void readImageSector(SdFile* file, byte* data, unsigned long size);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * lcd_display.cpp - Updates the LCD without blocking the SIO bus.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "lcd_display.h"
+#include "config.h"
+
+#ifdef LCD_DISPLAY
+// the cursor position when it isn't known (e.g. after writing the end of a line)
+const byte CURSOR_UNKNOWN = LCD_ROWS * LCD_COLS;
+
+LCDDisplay::LCDDisplay(LiquidCrystal* lcd) {
+  m_lcd = lcd;
+  m_scanPos = 0;
+  m_cursorPos = CURSOR_UNKNOWN;
+  m_sector = 0;
+  m_operation = 0;
+  m_bytes = 0;
+  m_statusTime = 0;
+}
+
+void LCDDisplay::begin() {
+  m_lcd->begin(LCD_COLS, LCD_ROWS);
+  m_lcd->clear();
+  memset(m_shown, ' ', sizeof(m_shown));
+  memset(m_wanted, ' ', sizeof(m_wanted));
+  m_cursorPos = CURSOR_UNKNOWN;
+}
+
+void LCDDisplay::setLine(byte row, const char* text) {
+  char* line = &m_wanted[row * LCD_COLS];
+  byte i = 0;
+  for (; i < LCD_COLS && text[i]; i++) {
+    line[i] = text[i];
+  }
+  for (; i < LCD_COLS; i++) {
+    line[i] = ' ';
+  }
+
+  // text on the activity line stays until there's new activity
+  if (row == 1) {
+    m_operation = 0;
+  }
+}
+
+void LCDDisplay::setLine(byte row, const __FlashStringHelper* text) {
+  char buffer[LCD_COLS + 1];
+  strncpy_P(buffer, (const char*)text, LCD_COLS);
+  buffer[LCD_COLS] = '\0';
+  setLine(row, buffer);
+}
+
+/**
+ * Notes a sector access for the activity line. This is called while a command is being
+ * handled, so it only counts.
+ */
+void LCDDisplay::recordAccess(unsigned long sector, unsigned int length, boolean write) {
+  m_sector = sector;
+  m_operation = write ? 'W' : 'R';
+  m_bytes += length;
+}
+
+/**
+ * Sends a few changed characters to the LCD. Call this only while the bus is idle.
+ */
+void LCDDisplay::update() {
+  if (millis() - m_statusTime >= LCD_STATUS_INTERVAL) {
+    updateStatus();
+  }
+
+  byte sent = 0;
+  for (byte i=0; i < LCD_ROWS * LCD_COLS && sent < LCD_CHARS_PER_UPDATE; i++) {
+    if (m_shown[m_scanPos] != m_wanted[m_scanPos]) {
+      pushChar(m_scanPos);
+      sent++;
+    }
+    m_scanPos = (m_scanPos + 1) % (LCD_ROWS * LCD_COLS);
+  }
+}
+
+/**
+ * Sends everything that has changed right away (for use before the SIO bus is running).
+ */
+void LCDDisplay::flush() {
+  for (byte i=0; i < LCD_ROWS * LCD_COLS; i++) {
+    if (m_shown[i] != m_wanted[i]) {
+      pushChar(i);
+    }
+  }
+}
+
+/**
+ * Rebuilds the activity line (e.g. "R   123   1.8K/s") from the accesses recorded since
+ * the last time.
+ */
+void LCDDisplay::updateStatus() {
+  unsigned long now = millis();
+  unsigned long elapsed = now - m_statusTime;
+  m_statusTime = now;
+
+  if (!m_operation) {
+    m_bytes = 0;
+    return;
+  }
+
+  char* line = &m_wanted[LCD_COLS];
+  memset(line, ' ', LCD_COLS);
+  line[0] = m_bytes ? m_operation : '-';
+  setNumber(1, 2, 5, m_sector);
+
+  // tenths of a KB/s
+  unsigned long rate = m_bytes * 10000 / 1024 / elapsed;
+  setNumber(1, 8, 3, rate / 10);
+  line[11] = '.';
+  line[12] = '0' + rate % 10;
+  memcpy(&line[13], "K/s", 3);
+
+  m_bytes = 0;
+}
+
+void LCDDisplay::setNumber(byte row, byte col, byte width, unsigned long n) {
+  char* p = &m_wanted[row * LCD_COLS + col + width - 1];
+  for (byte i=0; i < width; i++, p--) {
+    *p = (i == 0 || n) ? '0' + n % 10 : ' ';
+    n /= 10;
+  }
+}
+
+void LCDDisplay::pushChar(byte pos) {
+  if (m_cursorPos != pos) {
+    m_lcd->setCursor(pos % LCD_COLS, pos / LCD_COLS);
+  }
+  m_lcd->write(m_wanted[pos]);
+  m_shown[pos] = m_wanted[pos];
+
+  // the LCD moves the cursor along by itself, but not from one line to the next
+  m_cursorPos = ((pos + 1) % LCD_COLS) ? pos + 1 : CURSOR_UNKNOWN;
+}
+#endif
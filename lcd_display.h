@@ -0,0 +1,46 @@
+#ifndef LCD_DISPLAY_h
+#define LCD_DISPLAY_h
+
+#include <Arduino.h>
+#include <LiquidCrystal.h>
+
+#define LCD_COLS 16
+#define LCD_ROWS 2
+
+// how many changed characters are sent to the LCD per update (each takes ~100us)
+const byte LCD_CHARS_PER_UPDATE         = 2;
+// how often the activity line is recalculated
+const unsigned long LCD_STATUS_INTERVAL = 1000;
+
+/**
+ * Drives the LCD from a shadow copy of its contents. Text is only written to the shadow
+ * copy; update() then sends a few of the characters that differ from what the LCD shows,
+ * so the LCD's slow bus never holds up SIO traffic. The second line shows the last
+ * sector accessed, whether it was read or written and the throughput.
+ */
+class LCDDisplay {
+public:
+  LCDDisplay(LiquidCrystal* lcd);
+  void begin();
+  void setLine(byte row, const char* text);
+  void setLine(byte row, const __FlashStringHelper* text);
+  void recordAccess(unsigned long sector, unsigned int length, boolean write);
+  void update();
+  void flush();
+private:
+  void updateStatus();
+  void setNumber(byte row, byte col, byte width, unsigned long n);
+  void pushChar(byte pos);
+
+  LiquidCrystal*  m_lcd;
+  char            m_shown[LCD_ROWS * LCD_COLS];
+  char            m_wanted[LCD_ROWS * LCD_COLS];
+  byte            m_scanPos;
+  byte            m_cursorPos;
+  unsigned long   m_sector;
+  char            m_operation;
+  unsigned long   m_bytes;
+  unsigned long   m_statusTime;
+};
+
+#endif
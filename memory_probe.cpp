@@ -0,0 +1,135 @@
+/*
+ * memory_probe.cpp - Tracks free RAM and stack high-water.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "memory_probe.h"
+#include "config.h"
+
+#ifdef MEMORY_PROBE
+// provided by the linker and avr-libc
+extern byte __data_start;
+extern byte _end;
+extern byte __stack;
+extern char* __brkval;
+
+/**
+ * Paints everything from the end of the static data to the top of the stack. This runs
+ * from .init3, before any constructors and before main() has put anything on the stack,
+ * so it can't call anything or keep state outside of registers.
+ */
+void paintStack(void) __attribute__ ((naked)) __attribute__ ((used)) __attribute__ ((section (".init3")));
+void paintStack(void) {
+  byte* p = &_end;
+  while (p <= &__stack) {
+    *p = STACK_CANARY;
+    p++;
+  }
+}
+
+static byte* heapEnd() {
+  return (__brkval == 0) ? &_end : (byte*)__brkval;
+}
+
+MemoryProbe::MemoryProbe() {
+  m_lowWater = &__stack;
+  m_deepestDevice = 0;
+  m_deepestCommand = 0;
+}
+
+/**
+ * Finds the lowest address the stack has reached. Anything above the previous low water
+ * is known to be used already, so only the painted region below it is scanned.
+ */
+void MemoryProbe::sample(CommandFrame* cmdFrame) {
+  byte* p = heapEnd();
+  while (p < m_lowWater && *p == STACK_CANARY) {
+    p++;
+  }
+
+  if (p < m_lowWater) {
+    m_lowWater = p;
+    if (cmdFrame) {
+      m_deepestDevice = cmdFrame->deviceId;
+      m_deepestCommand = cmdFrame->command;
+    }
+    LOG_MSG(F("Stack high water: "));
+    LOG_MSG(getStackHighWater());
+    LOG_MSG(F(" bytes, "));
+    LOG_MSG(getUnusedStack());
+    LOG_MSG_CR(F(" never used"));
+  }
+}
+
+unsigned int MemoryProbe::getStaticSize() {
+  return &_end - &__data_start;
+}
+
+/**
+ * Returns the RAM between the heap and the current stack pointer.
+ */
+unsigned int MemoryProbe::getFreeRam() {
+  byte top;
+  return &top - heapEnd();
+}
+
+unsigned int MemoryProbe::getStackHighWater() {
+  return &__stack - m_lowWater + 1;
+}
+
+/**
+ * Returns the painted RAM the stack has never reached (as of the last sample) -- the
+ * real headroom left for new buffers.
+ */
+unsigned int MemoryProbe::getUnusedStack() {
+  byte* end = heapEnd();
+  return (m_lowWater > end) ? m_lowWater - end : 0;
+}
+
+void MemoryProbe::getFrame(MemoryFrame* frame) {
+  frame->ramSize = RAMEND - RAMSTART + 1;
+  frame->staticSize = getStaticSize();
+  frame->freeRam = getFreeRam();
+  frame->stackHighWater = getStackHighWater();
+  frame->unusedStack = getUnusedStack();
+  frame->deepestDevice = m_deepestDevice;
+  frame->deepestCommand = m_deepestCommand;
+}
+
+void MemoryProbe::dump() {
+// we only compile this on DEBUG to save allocating string constants
+#ifdef DEBUG
+  LOG_MSG(F("RAM "));
+  LOG_MSG(RAMEND - RAMSTART + 1);
+  LOG_MSG(F(", static "));
+  LOG_MSG(getStaticSize());
+  LOG_MSG(F(", free "));
+  LOG_MSG(getFreeRam());
+  LOG_MSG(F(", stack high water "));
+  LOG_MSG(getStackHighWater());
+  LOG_MSG(F(" (deepest "));
+  LOG_MSG(m_deepestDevice, HEX);
+  LOG_MSG(F(" "));
+  LOG_MSG(m_deepestCommand, HEX);
+  LOG_MSG(F("), unused stack "));
+  LOG_MSG_CR(getUnusedStack());
+#endif
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef MEMORY_PROBE_h
+#define MEMORY_PROBE_h
+
+#include <Arduino.h>
+#include "atari.h"
+
+// the value the free RAM between the heap and the stack is painted with at boot
+const byte STACK_CANARY            = 0xC5;
+
+// SDrive memory command response (little-endian)
+struct MemoryFrame {
+  unsigned int ramSize;
+  unsigned int staticSize;
+  unsigned int freeRam;
+  unsigned int stackHighWater;
+  unsigned int unusedStack;
+  byte deepestDevice;
+  byte deepestCommand;
+};
+
+/**
+ * Measures RAM headroom. The stack is painted before the sketch starts; sampling after
+ * each SIO command finds how far down the stack has reached since then (and remembers
+ * the command that took it deepest).
+ */
+class MemoryProbe {
+public:
+  MemoryProbe();
+  void sample(CommandFrame* cmdFrame);
+  unsigned int getStaticSize();
+  unsigned int getFreeRam();
+  unsigned int getStackHighWater();
+  unsigned int getUnusedStack();
+  void getFrame(MemoryFrame* frame);
+  void dump();
+private:
+  byte*          m_lowWater;
+  byte           m_deepestDevice;
+  byte           m_deepestCommand;
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+ * printer_device.cpp - Emulates Atari printers, spooling their output to the SD card.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "printer_device.h"
+#include "config.h"
+
+#ifdef PRINTER_SPOOL
+
+const byte PRINTER_COMMANDS[] PROGMEM = {
+  CMD_PRINTER_WRITE, CMD_PRINTER_STATUS, 0
+};
+
+PrinterDevice::PrinterDevice(boolean translate) : SIODevice(DEVICE_P1, 4, PRINTER_COMMANDS) {
+  m_translate = translate;
+  m_oldest = 0;
+  m_count = 0;
+  m_nextJob = 0;
+  m_lastWrite = 0;
+  m_lastMode = 'N';
+}
+
+int PrinterDevice::processCommand(CommandFrame* cmdFrame, Stream* stream) {
+  switch (cmdFrame->command) {
+    case CMD_PRINTER_WRITE:
+      return cmdWrite(cmdFrame, stream);
+    case CMD_PRINTER_STATUS:
+      cmdGetStatus(stream);
+      break;
+  }
+
+  return 0;
+}
+
+byte* PrinterDevice::getDataFrameBuffer() {
+  return m_frameBuffer;
+}
+
+void PrinterDevice::processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T4);
+  stream->write(ACK);
+  STATS_MARK(ackTime);
+
+  // buffer the line (the OS pads the frame after the EOL, so that part is dropped)
+  for (int i=0; i < length; i++) {
+    byte b = m_frameBuffer[i];
+    m_buffer[(m_oldest + m_count) & (PRINTER_BUFFER_SIZE - 1)] = m_translate ? translate(b) : b;
+    m_count++;
+    if (b == ATASCII_EOL) {
+      break;
+    }
+  }
+  m_lastWrite = millis();
+
+  // send COMPLETE
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+  STATS_RECORD(STAT_CLASS_WRITE, STAT_ACK_TO_COMPLETE, ackTime);
+}
+
+/**
+ * Returns true while there's output to spool or a print job still open.
+ */
+boolean PrinterDevice::isPending() {
+  return (m_count > 0 || m_file.isOpen());
+}
+
+/**
+ * Background task that writes each block of buffered output to the spool file once it
+ * fills, and the partial block left at the end of a print job when it's closed.
+ */
+boolean PrinterDevice::spool() {
+  if (m_count >= PRINTER_BLOCK_SIZE) {
+    writeSpool(PRINTER_BLOCK_SIZE);
+    return false;
+  }
+
+  if (millis() - m_lastWrite > PRINTER_IDLE_CLOSE) {
+    if (m_count > 0) {
+      writeSpool(m_count);
+    }
+    if (m_file.isOpen()) {
+      m_file.close();
+    }
+    return true;
+  }
+  return false;
+}
+
+void PrinterDevice::cmdGetStatus(Stream* stream) {
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_STATUS, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+
+  // send complete
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+
+  // the printer never reports an error
+  byte status[4] = {0, m_lastMode, PRINTER_TIMEOUT, 0};
+  stream->write(status, sizeof(status));
+  stream->write(checksum(status, sizeof(status)));
+  stream->flush();
+}
+
+int PrinterDevice::cmdWrite(CommandFrame* cmdFrame, Stream* stream) {
+  int length;
+  switch (cmdFrame->aux2) {
+    case PRINTER_MODE_SIDEWAYS:
+      length = PRINTER_SIDEWAYS_SIZE;
+      break;
+    case PRINTER_MODE_DOUBLE:
+      length = PRINTER_DOUBLE_SIZE;
+      break;
+    default:
+      length = PRINTER_FRAME_SIZE;
+      break;
+  }
+  m_lastMode = cmdFrame->aux2;
+
+  // if the spooler has fallen behind, the Atari has to try again once it has caught up
+  if (m_count + length > PRINTER_BUFFER_SIZE) {
+    m_timing->waitFor(TIMING_T2);
+    stream->write(NAK);
+    STATS_COUNT(STAT_COUNT_NAK);
+    return 0;
+  }
+
+  // send ACK
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_WRITE, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+
+  // have the channel read the data frame
+  return length + 1;
+}
+
+/**
+ * Writes the oldest n bytes of buffered output. Output only leaves the ring a block at a
+ * time (until the job's last, partial block), so it always starts on a block boundary in
+ * both the ring and the file and never wraps. If there's nowhere to write it (e.g. no
+ * card), it's thrown away.
+ */
+void PrinterDevice::writeSpool(unsigned int n) {
+  if ((m_file.isOpen() || openSpoolFile()) && m_file.write(m_buffer + m_oldest, n) == n) {
+    m_oldest = (m_oldest + n) & (PRINTER_BUFFER_SIZE - 1);
+    m_count -= n;
+  } else {
+    LOG_MSG_CR(F("Printer output lost"));
+    m_count = 0;
+  }
+  // (a partial block ends the job, so the next one starts back at a block boundary)
+  if (m_count == 0) {
+    m_oldest = 0;
+  }
+}
+
+/**
+ * Opens the next unused /PRINTnnn.TXT file for a new print job.
+ */
+boolean PrinterDevice::openSpoolFile() {
+  char name[] = "/PRINT000.TXT";
+
+  for (; m_nextJob < PRINTER_MAX_JOBS; m_nextJob++) {
+    name[6] = '0' + m_nextJob / 100;
+    name[7] = '0' + (m_nextJob / 10) % 10;
+    name[8] = '0' + m_nextJob % 10;
+    if (m_file.open(name, O_WRONLY | O_CREAT | O_EXCL)) {
+      LOG_MSG(F("Spooling printer output to "));
+      LOG_MSG_CR(name);
+      m_nextJob++;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/**
+ * Converts a character to ASCII. Inverse video is dropped and the graphics characters
+ * that have no ASCII equivalent are printed as spaces.
+ */
+byte PrinterDevice::translate(byte b) {
+  if (b == ATASCII_EOL) {
+    return '\n';
+  } else if (b == ATASCII_TAB) {
+    return '\t';
+  }
+
+  b &= 0x7F;
+  if ((b >= 0x20 && b < 0x60) || (b > 0x60 && b < 0x7B) || b == '|') {
+    return b;
+  }
+  return ' ';
+}
+
+boolean PrinterDevice::printCmdName(CommandFrame* cmdFrame) {
+// we only compile this on DEBUG to save allocating string constants
+#ifdef DEBUG
+  switch (cmdFrame->command) {
+    case CMD_PRINTER_WRITE:
+      LOG_MSG(F("PRINT"));
+      break;
+    case CMD_PRINTER_STATUS:
+      LOG_MSG(F("PRINTER STATUS"));
+      break;
+    default:
+      return false;
+  }
+#endif
+
+  return true;
+}
+
+#endif
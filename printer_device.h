@@ -0,0 +1,71 @@
+#ifndef PRINTER_DEVICE_h
+#define PRINTER_DEVICE_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+#include "atari.h"
+#include "sio_device.h"
+
+const byte DEVICE_P1                  = 0x40;
+
+const byte CMD_PRINTER_STATUS         = 0x53;
+const byte CMD_PRINTER_WRITE          = 0x57;
+
+// the print modes sent in aux2 of a write, which set the length of its data frame
+const byte PRINTER_MODE_SIDEWAYS      = 'S';
+const byte PRINTER_MODE_DOUBLE        = 'D';
+const byte PRINTER_FRAME_SIZE         = 40;
+const byte PRINTER_SIDEWAYS_SIZE      = 29;
+const byte PRINTER_DOUBLE_SIZE        = 20;
+
+// the timeout (in seconds) reported in the status frame
+const byte PRINTER_TIMEOUT            = 0x1E;
+
+// output goes to the card a whole (aligned) block at a time, so it's written straight to
+// the card rather than through SdFat's block cache (which D1: reads share)
+const unsigned int PRINTER_BLOCK_SIZE  = 512;
+// RAM set aside for output that hasn't been spooled yet: one block can fill while the
+// other waits to be written
+const unsigned int PRINTER_BUFFER_SIZE = 2 * PRINTER_BLOCK_SIZE;
+// a print job ends (and its spool file is closed) once nothing has been printed for this long
+const unsigned long PRINTER_IDLE_CLOSE = 5000;
+const unsigned int PRINTER_MAX_JOBS    = 1000;
+
+const byte ATASCII_EOL                = 0x9B;
+const byte ATASCII_TAB                = 0x7F;
+
+/**
+ * Emulates printers P1-P4. Write frames are acknowledged as soon as they're copied into
+ * a RAM ring buffer; spool() later moves the buffered output to /PRINTnnn.TXT on the
+ * card (one file per print job) a block at a time while the bus is idle, so printing
+ * runs at full SIO speed. A write that comes in while the buffer is full is NAKed (and
+ * retried by the Atari) rather than holding up the bus.
+ */
+class PrinterDevice : public SIODevice {
+public:
+  PrinterDevice(boolean translate);
+  int processCommand(CommandFrame* cmdFrame, Stream* stream);
+  byte* getDataFrameBuffer();
+  void processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream);
+  boolean printCmdName(CommandFrame* cmdFrame);
+  boolean isPending();
+  boolean spool();
+private:
+  void cmdGetStatus(Stream* stream);
+  int cmdWrite(CommandFrame* cmdFrame, Stream* stream);
+  void writeSpool(unsigned int n);
+  boolean openSpoolFile();
+  byte translate(byte b);
+
+  SdFile            m_file;
+  boolean           m_translate;
+  byte              m_buffer[PRINTER_BUFFER_SIZE];
+  unsigned int      m_oldest;
+  unsigned int      m_count;
+  unsigned int      m_nextJob;
+  unsigned long     m_lastWrite;
+  byte              m_lastMode;
+  byte              m_frameBuffer[PRINTER_FRAME_SIZE + 1];
+};
+
+#endif
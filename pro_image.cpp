@@ -0,0 +1,81 @@
+/*
+ * pro_image.cpp - Serves APE PRO images with their recorded sector status.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "pro_image.h"
+
+#ifdef PRO_IMAGES
+boolean PROImage::isPROImage(byte* header, unsigned long fileSize) {
+  PROFileHeader* proHeader = (PROFileHeader*)header;
+  return (proHeader->sectorCountHi * 256 + proHeader->sectorCountLo == ((fileSize-PRO_HEADER_SIZE)/(SECTOR_SIZE_SD+sizeof(PROSectorHeader))) && proHeader->magic == 'P');
+}
+
+void PROImage::load(PROFileHeader* header) {
+  m_usePhantoms = false;
+  m_phantomFlip = false;
+
+  // set the phantom emulation mode
+  switch (header->phantomSectorMode) {
+    case PSM_SIMPLE:
+    case PSM_MINDSCAPE_SPECIAL:
+    case PSM_STICKY:
+    case PSM_SHIMMERING:
+    case PSM_REVERSE_SHIMMER:
+      m_usePhantoms = false;
+      break;
+    case PSM_GLOBAL_FLIP_FLOP:
+      m_usePhantoms = true;
+      m_phantomFlip = false;
+      break;
+    case PSM_GLOBAL_FLOP_FLIP:
+      m_usePhantoms = true;
+      m_phantomFlip = true;
+      break;
+  }
+}
+
+void PROImage::getSectorData(SdFile* file, unsigned long sector, byte* data, SectorDataInfo* info) {
+  // we seek based on the sector number + the sector header size (omitting the header)
+  file->seekSet(PRO_HEADER_SIZE + ((sector - 1) * (SECTOR_SIZE_SD + sizeof(PROSectorHeader))));
+
+  // then we read the sector header
+  if (file->read(&m_sectorHeader, sizeof(PROSectorHeader)) != sizeof(PROSectorHeader)) {
+    memset(&m_sectorHeader, 0xFF, sizeof(PROSectorHeader));
+  }
+
+  // return the status frame so the drive can return it on a subsequent status command
+  memcpy(&info->statusFrame, &m_sectorHeader, sizeof(info->statusFrame));
+  info->validStatusFrame = true;
+
+  // if the header shows there was an error in this sector, return an error
+  if (!m_sectorHeader.statusFrame.hardwareStatus.crcError || !m_sectorHeader.statusFrame.hardwareStatus.dataLostOrTrack0 || !m_sectorHeader.statusFrame.hardwareStatus.recordNotFound) {
+    info->error = true;
+  } else {
+    // if there are phantom sector(s) associated with this sector, decide what to return
+    if (m_usePhantoms && m_sectorHeader.totalPhantoms > 0 && m_phantomFlip) {
+      file->seekSet(PRO_HEADER_SIZE + (((720 + m_sectorHeader.phantom1) - 1) * (SECTOR_SIZE_SD + sizeof(PROSectorHeader))) + sizeof(PROSectorHeader));
+    }
+  }
+  m_phantomFlip = !m_phantomFlip; // TODO: do bad sectors cause this to flip?
+
+  readImageSector(file, data, SECTOR_SIZE_SD);
+}
+#endif
@@ -0,0 +1,67 @@
+#ifndef PRO_IMAGE_h
+#define PRO_IMAGE_h
+
+#include "image_format.h"
+
+#ifdef PRO_IMAGES
+#define PRO_HEADER_SIZE 16
+
+const byte PSM_SIMPLE            = 0;
+const byte PSM_MINDSCAPE_SPECIAL = 1;
+const byte PSM_GLOBAL_FLIP_FLOP  = 2;
+const byte PSM_GLOBAL_FLOP_FLIP  = 3;
+const byte PSM_HEURISTIC         = 4;
+const byte PSM_STICKY            = 5;
+const byte PSM_REVERSE_STICKY    = 6;
+const byte PSM_SHIMMERING        = 7;
+const byte PSM_REVERSE_SHIMMER   = 8;
+const byte PSM_ROLLING_THUNDER   = 9;
+
+struct PROFileHeader {
+  byte sectorCountHi;
+  byte sectorCountLo;
+  byte magic;
+  byte imageType;
+  byte phantomSectorMode;
+  byte sectorReadDelay;
+  byte g;
+  byte h;
+  byte i;
+  byte j;
+  byte k;
+  byte l;
+  byte m;
+  byte n;
+  byte o;
+  byte p;
+};
+
+struct PROSectorHeader {
+  StatusFrame statusFrame;
+  byte m;
+  byte totalPhantoms;
+  byte phantom4;
+  byte phantom1;
+  byte phantom2;
+  byte phantom3;
+  byte n;
+  byte phantom5;
+};
+
+/**
+ * An APE PRO image: every sector is preceded by the status frame the drive returned for
+ * it, and phantom (duplicate) sectors are stored after sector 720.
+ */
+class PROImage {
+public:
+  static boolean isPROImage(byte* header, unsigned long fileSize);
+  void load(PROFileHeader* header);
+  void getSectorData(SdFile* file, unsigned long sector, byte* data, SectorDataInfo* info);
+private:
+  PROSectorHeader  m_sectorHeader;
+  boolean          m_usePhantoms;
+  boolean          m_phantomFlip;
+};
+#endif
+
+#endif
@@ -0,0 +1,266 @@
+/*
+ * rs232_device.cpp - Emulates the R1: serial port of an Atari 850 interface.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "rs232_device.h"
+#include "sio_channel.h"
+#include "config.h"
+
+#ifdef RS232_DEVICE
+
+const byte RS232_COMMANDS[] PROGMEM = {
+  CMD_RS232_CONTROL, CMD_RS232_CONFIGURE, CMD_RS232_STATUS, CMD_RS232_WRITE, CMD_RS232_CONCURRENT, 0
+};
+
+// the rates selected by the low 4 bits of the configure command's aux1 (the fractional
+// rates of the 850 are rounded)
+const unsigned int RS232_BAUD_RATES[] PROGMEM = {
+  300, 45, 50, 57, 75, 110, 134, 150, 300, 600, 1200, 1800, 2400, 4800, 9600, 19200
+};
+
+RS232Device::RS232Device(HardwareSerial* sioUart, HardwareSerial* port) : SIODevice(DEVICE_R1, 1, RS232_COMMANDS) {
+  m_sioUart = sioUart;
+  m_port = port;
+  m_sioBaudRate = SIO_BAUD_RATE;
+  m_errors = 0;
+  m_writeLength = 0;
+  m_toPortHead = 0;
+  m_toPortTail = 0;
+  m_toAtariHead = 0;
+  m_toAtariTail = 0;
+
+  // 300 baud, 8 data bits and 1 stop bit, as an 850 starts out
+  m_config = 0;
+}
+
+/**
+ * Opens the port (this has to wait for setup(), after the core has initialized).
+ */
+void RS232Device::begin() {
+  m_port->begin(getBaudRate());
+}
+
+/**
+ * Sets the rate the bus goes back to when concurrent mode ends.
+ */
+void RS232Device::setSioBaudRate(unsigned long baudRate) {
+  m_sioBaudRate = baudRate;
+}
+
+int RS232Device::processCommand(CommandFrame* cmdFrame, Stream* stream) {
+  switch (cmdFrame->command) {
+    case CMD_RS232_CONTROL:
+      cmdControl(stream);
+      break;
+    case CMD_RS232_CONFIGURE:
+      cmdConfigure(cmdFrame, stream);
+      break;
+    case CMD_RS232_STATUS:
+      cmdGetStatus(stream);
+      break;
+    case CMD_RS232_WRITE:
+      return cmdWrite(cmdFrame, stream);
+    case CMD_RS232_CONCURRENT:
+      return cmdConcurrent(stream);
+  }
+
+  return 0;
+}
+
+byte* RS232Device::getDataFrameBuffer() {
+  return m_frameBuffer;
+}
+
+/**
+ * Queues the used part of a block mode write for the port.
+ */
+void RS232Device::processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream) {
+  m_timing->waitFor(TIMING_T4);
+  stream->write(ACK);
+
+  for (byte i=0; i < m_writeLength; i++) {
+    // (this only waits if a write follows a burst of concurrent mode output)
+    while ((byte)(m_toPortHead - m_toPortTail) == RS232_BUFFER_SIZE) {
+      service();
+    }
+    m_toPort[m_toPortHead++ & (RS232_BUFFER_SIZE - 1)] = m_frameBuffer[i];
+  }
+  service();
+
+  sendComplete(stream);
+}
+
+void RS232Device::processConcurrentByte(byte b, Stream* stream) {
+  if ((byte)(m_toPortHead - m_toPortTail) == RS232_BUFFER_SIZE) {
+    m_errors |= RS232_ERROR_OVERRUN;
+    return;
+  }
+  m_toPort[m_toPortHead++ & (RS232_BUFFER_SIZE - 1)] = b;
+}
+
+/**
+ * Moves bytes in both directions, never more than the UART transmit buffers will take
+ * without blocking.
+ */
+void RS232Device::runConcurrent(Stream* stream) {
+  while (m_port->available() > 0) {
+    if ((byte)(m_toAtariHead - m_toAtariTail) == RS232_BUFFER_SIZE) {
+      m_errors |= RS232_ERROR_OVERRUN;
+      break;
+    }
+    m_toAtari[m_toAtariHead++ & (RS232_BUFFER_SIZE - 1)] = m_port->read();
+  }
+
+  while (m_toAtariHead != m_toAtariTail && m_sioUart->availableForWrite() > 0) {
+    stream->write(m_toAtari[m_toAtariTail++ & (RS232_BUFFER_SIZE - 1)]);
+  }
+
+  service();
+}
+
+void RS232Device::endConcurrent() {
+  // whatever the Atari hasn't picked up yet is lost with the mode
+  m_toAtariHead = m_toAtariTail = 0;
+  m_sioUart->begin(m_sioBaudRate);
+}
+
+/**
+ * Sends queued bytes out of the port. This should be called from loop() so output left
+ * over when concurrent mode ends still goes out.
+ */
+void RS232Device::service() {
+  while (m_toPortHead != m_toPortTail && m_port->availableForWrite() > 0) {
+    m_port->write(m_toPort[m_toPortTail++ & (RS232_BUFFER_SIZE - 1)]);
+  }
+}
+
+void RS232Device::cmdControl(Stream* stream) {
+  // there are no handshake lines to set
+  sendAck(stream);
+  sendComplete(stream);
+}
+
+void RS232Device::cmdConfigure(CommandFrame* cmdFrame, Stream* stream) {
+  sendAck(stream);
+
+  m_config = cmdFrame->aux1;
+
+  // the AVR frame format bits (as in SERIAL_8N1): word size - 5 in bits 1-2, 2 stop bits in
+  // bit 3 (the 850 counts its word size field down from 8 bits, so it's flipped)
+  byte format = (3 - ((m_config >> RS232_WORD_SIZE_SHIFT) & RS232_WORD_SIZE_MASK)) << 1;
+  if (m_config & RS232_TWO_STOP_BITS) {
+    format |= 0x08;
+  }
+  m_port->flush();
+  m_port->begin(getBaudRate(), format);
+
+  sendComplete(stream);
+}
+
+void RS232Device::cmdGetStatus(Stream* stream) {
+  sendAck(stream);
+  sendComplete(stream);
+
+  byte status[2] = {m_errors, RS232_LINES_READY};
+  m_errors = 0;
+
+  stream->write(status, sizeof(status));
+  stream->write(checksum(status, sizeof(status)));
+  stream->flush();
+}
+
+int RS232Device::cmdWrite(CommandFrame* cmdFrame, Stream* stream) {
+  m_writeLength = min(cmdFrame->aux1, RS232_BLOCK_SIZE);
+  sendAck(stream);
+
+  // have the channel read the data frame
+  return RS232_BLOCK_SIZE + 1;
+}
+
+/**
+ * Tells the Atari how to set up POKEY for the configured rate and then switches the bus
+ * over to it.
+ */
+int RS232Device::cmdConcurrent(Stream* stream) {
+  sendAck(stream);
+  sendComplete(stream);
+
+  unsigned int divisor = (POKEY_CLOCK / getBaudRate() + 1) / 2 - 7;
+  byte frame[RS232_CONCURRENT_FRAME] = {
+    (byte)(divisor & 0xFF), RS232_AUDC, (byte)(divisor >> 8), RS232_AUDC,
+    (byte)(divisor & 0xFF), RS232_AUDC, (byte)(divisor >> 8), RS232_AUDC,
+    RS232_AUDCTL
+  };
+  stream->write(frame, sizeof(frame));
+  stream->write(checksum(frame, sizeof(frame)));
+  stream->flush();
+
+  m_toAtariHead = m_toAtariTail = 0;
+  m_sioUart->begin(getBaudRate());
+
+  return CONCURRENT_MODE;
+}
+
+void RS232Device::sendAck(Stream* stream) {
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  STATS_RECORD(STAT_CLASS_OTHER, STAT_CMD_TO_ACK, m_stats->getCommandStart());
+}
+
+void RS232Device::sendComplete(Stream* stream) {
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+}
+
+unsigned long RS232Device::getBaudRate() {
+  return pgm_read_word(&RS232_BAUD_RATES[m_config & RS232_BAUD_MASK]);
+}
+
+boolean RS232Device::printCmdName(CommandFrame* cmdFrame) {
+// we only compile this on DEBUG to save allocating string constants
+#ifdef DEBUG
+  switch (cmdFrame->command) {
+    case CMD_RS232_CONTROL:
+      LOG_MSG(F("RS232 CONTROL"));
+      break;
+    case CMD_RS232_CONFIGURE:
+      LOG_MSG(F("RS232 CONFIGURE "));
+      LOG_MSG(cmdFrame->aux1, HEX);
+      break;
+    case CMD_RS232_STATUS:
+      LOG_MSG(F("RS232 STATUS"));
+      break;
+    case CMD_RS232_WRITE:
+      LOG_MSG(F("RS232 WRITE "));
+      LOG_MSG(cmdFrame->aux1);
+      break;
+    case CMD_RS232_CONCURRENT:
+      LOG_MSG(F("RS232 CONCURRENT"));
+      break;
+    default:
+      return false;
+  }
+#endif
+
+  return true;
+}
+
+#endif
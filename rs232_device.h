@@ -0,0 +1,88 @@
+#ifndef RS232_DEVICE_h
+#define RS232_DEVICE_h
+
+#include <Arduino.h>
+#include "atari.h"
+#include "sio_device.h"
+
+const byte CMD_RS232_CONTROL          = 0x41;
+const byte CMD_RS232_CONFIGURE        = 0x42;
+const byte CMD_RS232_STATUS           = 0x53;
+const byte CMD_RS232_WRITE            = 0x57;
+const byte CMD_RS232_CONCURRENT       = 0x58;
+
+// block mode writes always send a full frame; aux1 says how many of its bytes are used
+const byte RS232_BLOCK_SIZE           = 64;
+const byte RS232_CONCURRENT_FRAME     = 9;
+
+// bytes waiting in each direction during concurrent mode (a power of 2 of at most 128,
+// so the free running byte indexes can't lap each other)
+const byte RS232_BUFFER_SIZE          = 128;
+
+// configure command aux1 fields
+const byte RS232_BAUD_MASK            = 0x0F;
+const byte RS232_WORD_SIZE_SHIFT      = 4;  // 0 = 8 bits ... 3 = 5 bits
+const byte RS232_WORD_SIZE_MASK       = 0x03;
+const byte RS232_TWO_STOP_BITS        = 0x80;
+
+// status frame bits
+const byte RS232_ERROR_OVERRUN        = 0x20;
+const byte RS232_LINES_READY          = 0xA8; // DSR, CTS and carrier all on
+
+// POKEY setup sent back when concurrent mode starts: channels 1+2 and 3+4 joined and
+// clocked at 1.79MHz, with silent pure tones
+const byte RS232_AUDC                 = 0xA0;
+const byte RS232_AUDCTL               = 0x78;
+const unsigned long POKEY_CLOCK       = 1789790;
+
+/**
+ * Emulates the R1: port of an Atari 850 interface on a second hardware UART. Block mode
+ * writes and the control, configure and status commands are answered like an 850; once
+ * concurrent mode starts the Atari talks straight to the port at the configured rate
+ * (both UARTs are switched over) until it sends its next command.
+ *
+ * The UARTs' own interrupt-driven buffers take the bytes off the wire; a ring buffer in
+ * each direction sits between them so a burst in one direction never blocks the loop
+ * (and with it the other direction) while the receiving side catches up.
+ *
+ * The R: handler isn't served to the Atari, so it has to be loaded from disk.
+ */
+class RS232Device : public SIODevice {
+public:
+  RS232Device(HardwareSerial* sioUart, HardwareSerial* port);
+  void begin();
+  void setSioBaudRate(unsigned long baudRate);
+  int processCommand(CommandFrame* cmdFrame, Stream* stream);
+  byte* getDataFrameBuffer();
+  void processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream);
+  void processConcurrentByte(byte b, Stream* stream);
+  void runConcurrent(Stream* stream);
+  void endConcurrent();
+  boolean printCmdName(CommandFrame* cmdFrame);
+  void service();
+private:
+  void cmdControl(Stream* stream);
+  void cmdConfigure(CommandFrame* cmdFrame, Stream* stream);
+  void cmdGetStatus(Stream* stream);
+  int cmdWrite(CommandFrame* cmdFrame, Stream* stream);
+  int cmdConcurrent(Stream* stream);
+  void sendAck(Stream* stream);
+  void sendComplete(Stream* stream);
+  unsigned long getBaudRate();
+
+  HardwareSerial*   m_sioUart;
+  HardwareSerial*   m_port;
+  unsigned long     m_sioBaudRate;
+  byte              m_config;
+  byte              m_errors;
+  byte              m_writeLength;
+  byte              m_frameBuffer[RS232_BLOCK_SIZE + 1];
+  byte              m_toPort[RS232_BUFFER_SIZE];
+  byte              m_toPortHead;
+  byte              m_toPortTail;
+  byte              m_toAtari[RS232_BUFFER_SIZE];
+  byte              m_toAtariHead;
+  byte              m_toAtariTail;
+};
+
+#endif
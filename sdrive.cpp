@@ -24,36 +24,37 @@
 #import "sdrive.h"
 #import "config.h"
 
-SDriveHandler::SDriveHandler() {
-}
+const byte SDRIVE_COMMANDS[] PROGMEM = {
+  CMD_SDRIVE_IDENT, CMD_SDRIVE_INIT, CMD_SDRIVE_CHROOT, CMD_SDRIVE_SWAP_VDN, CMD_SDRIVE_GETPARAMS,
+  CMD_SDRIVE_GET_ENTRIES, CMD_SDRIVE_CHDIR_VDN, CMD_SDRIVE_CHDIR, CMD_SDRIVE_CHDIR_UP, CMD_SDRIVE_GET20,
+  CMD_SDRIVE_MOUNT_D0, CMD_SDRIVE_MOUNT_D1, CMD_SDRIVE_MOUNT_D2, CMD_SDRIVE_MOUNT_D3, CMD_SDRIVE_MOUNT_D4,
+  CMD_SDRIVE_SET_TIMING,
+#ifdef SIO_STATS
+  CMD_SDRIVE_GET_STATS,
+#endif
+#ifdef MEMORY_PROBE
+  CMD_SDRIVE_GET_MEMORY,
+#endif
+#ifdef IMAGE_COPY
+  CMD_SDRIVE_DUPLICATE, CMD_SDRIVE_COPY_STATUS,
+#endif
+  0
+};
 
-void SDriveHandler::setDriveControl(DriveControl* driveControl) {
+SDriveHandler::SDriveHandler(DriveControl* driveControl) : SIODevice(DEVICE_SDRIVE, 1, SDRIVE_COMMANDS) {
   m_driveControl = driveControl;
+#ifdef MEMORY_PROBE
+  m_memoryProbe = NULL;
+#endif
+#ifdef IMAGE_COPY
+  m_imageCopier = NULL;
+#endif
 }
 
-boolean SDriveHandler::isValidCommand(byte cmd) {
-  return (cmd == CMD_SDRIVE_IDENT ||
-          cmd == CMD_SDRIVE_INIT ||
-          cmd == CMD_SDRIVE_CHROOT ||
-          cmd == CMD_SDRIVE_SWAP_VDN ||
-          cmd == CMD_SDRIVE_GETPARAMS ||
-          cmd == CMD_SDRIVE_GET_ENTRIES ||
-          cmd == CMD_SDRIVE_CHDIR_VDN ||
-          cmd == CMD_SDRIVE_CHDIR ||
-          cmd == CMD_SDRIVE_CHDIR_UP ||
-          cmd == CMD_SDRIVE_GET20 ||
-          cmd == CMD_SDRIVE_MOUNT_D0 ||
-          cmd == CMD_SDRIVE_MOUNT_D1 ||
-          cmd == CMD_SDRIVE_MOUNT_D2 ||
-          cmd == CMD_SDRIVE_MOUNT_D3 ||
-          cmd == CMD_SDRIVE_MOUNT_D4);
-}
-
-boolean SDriveHandler::isValidDevice(byte device) {
-  return (device == DEVICE_SDRIVE);
-}
+int SDriveHandler::processCommand(CommandFrame* cmdFrame, Stream* stream) {
+  // SDrive commands are only timed end to end
+  STATS_MARK(start);
 
-void SDriveHandler::processCommand(CommandFrame* cmdFrame, Stream* stream) {
   switch (cmdFrame->command) {
     case CMD_SDRIVE_IDENT:
       cmdIdent(stream);
@@ -100,13 +101,37 @@ void SDriveHandler::processCommand(CommandFrame* cmdFrame, Stream* stream) {
     case CMD_SDRIVE_MOUNT_D4:
       cmdMountDrive(4, cmdFrame->aux2 * 256 + cmdFrame->aux1, stream);
       break;
+    case CMD_SDRIVE_SET_TIMING:
+      cmdSetTiming(cmdFrame->aux1, stream);
+      break;
+#ifdef SIO_STATS
+    case CMD_SDRIVE_GET_STATS:
+      cmdGetStats(cmdFrame->aux1 & 0x01, stream);
+      break;
+#endif
+#ifdef MEMORY_PROBE
+    case CMD_SDRIVE_GET_MEMORY:
+      cmdGetMemory(stream);
+      break;
+#endif
+#ifdef IMAGE_COPY
+    case CMD_SDRIVE_DUPLICATE:
+      cmdDuplicate(cmdFrame->aux2 * 256 + cmdFrame->aux1, stream);
+      break;
+    case CMD_SDRIVE_COPY_STATUS:
+      cmdCopyStatus(stream);
+      break;
+#endif
   }
+
+  STATS_RECORD(STAT_CLASS_OTHER, STAT_ACK_TO_COMPLETE, start);
+  return 0;
 }
 
 void SDriveHandler::cmdIdent(Stream *stream) {
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   stream->write("SDrive01");
   stream->write(0xB0);
@@ -115,36 +140,36 @@ void SDriveHandler::cmdIdent(Stream *stream) {
 
 void SDriveHandler::cmdInit(Stream *stream) {
   // NO-OP
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   stream->flush();
 }
 
 void SDriveHandler::cmdChroot(Stream *stream) {
   // NO-OP
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   stream->flush();
 }
 
 void SDriveHandler::cmdSwapVdn(Stream *stream) {
   // NO-OP
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   stream->flush();
 }
 
 void SDriveHandler::cmdGetParams(Stream *stream) {
   // NO-OP
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   stream->write(0x06);
   stream->write((byte)0x00);
@@ -154,9 +179,9 @@ void SDriveHandler::cmdGetParams(Stream *stream) {
 
 void SDriveHandler::cmdGetEntries(byte n, Stream *stream) {
   // NO-OP
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   for (int i=0; i < n * 12; i++) {
     stream->write((byte)0x00);
@@ -167,9 +192,9 @@ void SDriveHandler::cmdGetEntries(byte n, Stream *stream) {
 
 void SDriveHandler::cmdChdirVDN(Stream* stream) {
   // NO-OP
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   for (int i=0; i < 14; i++) {
     stream->write((byte)0x00);
@@ -179,12 +204,12 @@ void SDriveHandler::cmdChdirVDN(Stream* stream) {
 }
 
 void SDriveHandler::cmdChdirUp(bool getDirName, Stream* stream) {
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
 
   m_driveControl->changeDir(-1);
 
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
 
   if (getDirName) {
@@ -201,20 +226,20 @@ void SDriveHandler::cmdChdirUp(bool getDirName, Stream* stream) {
 }
 
 void SDriveHandler::cmdChdir(int ix, Stream* stream) {
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
 
   m_driveControl->changeDir(ix);
 
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   stream->flush();
 }
 
 void SDriveHandler::cmdGet20(int page, Stream *stream) {
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
   byte chkSum = 0;
 
@@ -253,20 +278,117 @@ void SDriveHandler::cmdGet20(int page, Stream *stream) {
 }
 
 void SDriveHandler::cmdMountDrive(byte driveNum, byte index, Stream* stream) {
-  delay(DELAY_T2);
+  m_timing->waitFor(TIMING_T2);
   stream->write(ACK);
 
   m_driveControl->mountFile(1, index);
 
-  delay(DELAY_T5);
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+  stream->flush();
+}
+
+/**
+ * Switches to the timing profile in aux1 (see sio_timing.h). The ACK and COMPLETE for
+ * this command still use the old profile.
+ */
+void SDriveHandler::cmdSetTiming(byte profile, Stream* stream) {
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  m_timing->waitFor(TIMING_T5);
+  stream->write(m_timing->setProfile(profile) ? COMPLETE : ERR);
+  stream->flush();
+}
+
+#ifdef SIO_STATS
+/**
+ * Returns the SIO statistics data frame (see SIOStats::writeFrame). If aux1 bit 0 is
+ * set the statistics are reset after being sent.
+ */
+void SDriveHandler::cmdGetStats(boolean reset, Stream* stream) {
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  m_timing->waitFor(TIMING_T5);
   stream->write(COMPLETE);
+  stream->write(m_stats->writeFrame(stream));
   stream->flush();
+
+  m_stats->dump();
+  if (reset) {
+    m_stats->reset();
+  }
 }
+#endif
+
+#ifdef MEMORY_PROBE
+void SDriveHandler::setMemoryProbe(MemoryProbe* probe) {
+  m_memoryProbe = probe;
+}
+
+/**
+ * Returns the RAM usage data frame (see MemoryFrame).
+ */
+void SDriveHandler::cmdGetMemory(Stream* stream) {
+  MemoryFrame frame;
+  m_memoryProbe->getFrame(&frame);
 
-boolean SDriveHandler::printCmdName(byte cmd) {
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+  stream->write((byte*)&frame, sizeof(frame));
+  stream->write(checksum((byte*)&frame, sizeof(frame)));
+  stream->flush();
+
+  m_memoryProbe->dump();
+}
+#endif
+
+#ifdef IMAGE_COPY
+void SDriveHandler::setImageCopier(ImageCopier* copier) {
+  m_imageCopier = copier;
+}
+
+/**
+ * Starts copying the image with the given index (as used by the mount commands) in the
+ * background. Fails if the entry is a directory or another copy is still running; the
+ * copy's progress is read with the copy status command.
+ */
+void SDriveHandler::cmdDuplicate(int index, Stream* stream) {
+  FileEntry entry;
+
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+
+  boolean started = (m_driveControl->getFileList(index, 1, &entry) == 1 && !entry.isDirectory &&
+                     m_imageCopier->start(entry.name));
+
+  m_timing->waitFor(TIMING_T5);
+  stream->write(started ? COMPLETE : ERR);
+  stream->flush();
+}
+
+/**
+ * Returns the copy status data frame (see CopyFrame).
+ */
+void SDriveHandler::cmdCopyStatus(Stream* stream) {
+  CopyFrame frame;
+  m_imageCopier->getFrame(&frame);
+
+  m_timing->waitFor(TIMING_T2);
+  stream->write(ACK);
+  m_timing->waitFor(TIMING_T5);
+  stream->write(COMPLETE);
+  stream->write((byte*)&frame, sizeof(frame));
+  stream->write(checksum((byte*)&frame, sizeof(frame)));
+  stream->flush();
+}
+#endif
+
+boolean SDriveHandler::printCmdName(CommandFrame* cmdFrame) {
 // we only compile this on DEBUG to save allocating string constants
 #ifdef DEBUG
-  switch (cmd) {
+  switch (cmdFrame->command) {
     case CMD_SDRIVE_IDENT:
       LOG_MSG(F("SDRIVE IDENT"));
       break;
@@ -312,6 +434,27 @@ boolean SDriveHandler::printCmdName(byte cmd) {
     case CMD_SDRIVE_MOUNT_D4:
       LOG_MSG(F("SDRIVE MOUNTvD4"));
       break;
+    case CMD_SDRIVE_SET_TIMING:
+      LOG_MSG(F("SDRIVE SET TIMING"));
+      break;
+#ifdef SIO_STATS
+    case CMD_SDRIVE_GET_STATS:
+      LOG_MSG(F("SDRIVE GET STATS"));
+      break;
+#endif
+#ifdef MEMORY_PROBE
+    case CMD_SDRIVE_GET_MEMORY:
+      LOG_MSG(F("SDRIVE GET MEMORY"));
+      break;
+#endif
+#ifdef IMAGE_COPY
+    case CMD_SDRIVE_DUPLICATE:
+      LOG_MSG(F("SDRIVE DUPLICATE"));
+      break;
+    case CMD_SDRIVE_COPY_STATUS:
+      LOG_MSG(F("SDRIVE COPY STATUS"));
+      break;
+#endif
     default:
       return false;
   }
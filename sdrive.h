@@ -3,11 +3,24 @@
 
 #include <Arduino.h>
 #include "atari.h"
+#include "config.h"
 #include "drive_control.h"
+#include "sio_device.h"
+#ifdef MEMORY_PROBE
+#include "memory_probe.h"
+#endif
+#ifdef IMAGE_COPY
+#include "image_copier.h"
+#endif
 
 const byte DEVICE_SDRIVE           = 0x71;
 
 const byte CMD_SDRIVE_GET20        = 0xC0;
+const byte CMD_SDRIVE_GET_STATS    = 0xD0;
+const byte CMD_SDRIVE_SET_TIMING   = 0xD1;
+const byte CMD_SDRIVE_GET_MEMORY   = 0xD2;
+const byte CMD_SDRIVE_DUPLICATE    = 0xD3;
+const byte CMD_SDRIVE_COPY_STATUS  = 0xD4;
 const byte CMD_SDRIVE_IDENT        = 0xE0;
 const byte CMD_SDRIVE_INIT         = 0xE1;
 const byte CMD_SDRIVE_CHDIR_VDN    = 0xE3;
@@ -23,14 +36,23 @@ const byte CMD_SDRIVE_CHDIR_UP     = 0xFD;
 const byte CMD_SDRIVE_CHROOT       = 0xFE;
 const byte CMD_SDRIVE_CHDIR        = 0xFF;
 
-class SDriveHandler {
+class SDriveHandler : public SIODevice {
 public:
-  SDriveHandler();
-  void setDriveControl(DriveControl* driveControl);
-  boolean printCmdName(byte cmd);
-  boolean isValidCommand(byte cmd);
-  boolean isValidDevice(byte device);
-  void processCommand(CommandFrame* cmdFrame, Stream* stream);
+  SDriveHandler(DriveControl* driveControl);
+#ifdef SIO_STATS
+  void cmdGetStats(boolean reset, Stream* stream);
+#endif
+#ifdef MEMORY_PROBE
+  void setMemoryProbe(MemoryProbe* probe);
+  void cmdGetMemory(Stream* stream);
+#endif
+#ifdef IMAGE_COPY
+  void setImageCopier(ImageCopier* copier);
+  void cmdDuplicate(int index, Stream* stream);
+  void cmdCopyStatus(Stream* stream);
+#endif
+  boolean printCmdName(CommandFrame* cmdFrame);
+  int processCommand(CommandFrame* cmdFrame, Stream* stream);
   void cmdIdent(Stream* stream);
   void cmdInit(Stream* stream);
   void cmdChroot(Stream* stream);
@@ -42,8 +64,15 @@ public:
   void cmdChdir(int index, Stream *stream);
   void cmdGet20(int startIndex, Stream *stream);
   void cmdMountDrive(byte driveNum, byte index, Stream* stream);
+  void cmdSetTiming(byte profile, Stream* stream);
   
   DriveControl* m_driveControl;
+#ifdef MEMORY_PROBE
+  MemoryProbe*  m_memoryProbe;
+#endif
+#ifdef IMAGE_COPY
+  ImageCopier*  m_imageCopier;
+#endif
 };
 
 #endif
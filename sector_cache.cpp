@@ -0,0 +1,264 @@
+/*
+ * sector_cache.cpp - Keeps recently used sectors of the mounted image in RAM.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sector_cache.h"
+#include "config.h"
+
+#ifdef SECTOR_CACHE
+
+SectorCache::SectorCache(DiskImage* image) {
+  m_image = image;
+  m_readAhead = SECTOR_CACHE_READ_AHEAD;
+  m_writeDelay = SECTOR_CACHE_WRITE_DELAY;
+  clear();
+}
+
+/**
+ * Sets how many sectors are read ahead and how long (in ms) writes are held before
+ * going out to the card. With no delay at all, writes go straight through.
+ */
+void SectorCache::setTuning(byte readAhead, unsigned int writeDelay) {
+  flush();
+  m_readAhead = readAhead;
+  m_writeDelay = writeDelay;
+}
+
+/**
+ * Forgets every cached sector (dirty ones included).
+ */
+void SectorCache::clear() {
+  for (byte i=0; i < SECTOR_CACHE_SLOTS; i++) {
+    m_slots[i].sector = 0;
+    m_slots[i].dirty = false;
+  }
+  m_useCounter = 0;
+  m_dirtyCount = 0;
+  m_lastRead = 0;
+  m_aheadNext = 0;
+  m_aheadEnd = 0;
+}
+
+/**
+ * Reads the VTOC and directory of a newly mounted image into the cache, since nearly
+ * every DOS operation starts there.
+ */
+void SectorCache::preload() {
+  byte data[SD_SECTOR_SIZE];
+
+  for (byte i=0; i < SECTOR_CACHE_PRELOAD_COUNT; i++) {
+    unsigned long sector = SECTOR_CACHE_PRELOAD_START + i;
+    SectorDataInfo* info = m_image->getSectorData(sector, data);
+    if (info->error) {
+      break;
+    }
+    fill(sector, data);
+  }
+}
+
+/**
+ * Copies a sector out of the cache. Returns false if it isn't there.
+ */
+boolean SectorCache::read(unsigned long sector, byte* data) {
+  CachedSector* slot = find(sector);
+  if (slot) {
+    memcpy(data, slot->data, SD_SECTOR_SIZE);
+    touch(slot);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Tracks the sectors the Atari reads; a read following on from the previous one moves
+ * the read-ahead window along, and any other read cancels it.
+ */
+void SectorCache::noteRead(unsigned long sector) {
+  if (sector == m_lastRead + 1u) {
+    m_aheadEnd = min(sector + m_readAhead, m_image->getSectorCount());
+    if (m_aheadNext <= sector) {
+      m_aheadNext = sector + 1;
+    }
+  } else {
+    m_aheadNext = 0;
+  }
+  m_lastRead = sector;
+}
+
+/**
+ * Adds a sector that was just read from the image.
+ */
+void SectorCache::fill(unsigned long sector, byte* data) {
+  CachedSector* slot = allocate(sector);
+  if (slot) {
+    memcpy(slot->data, data, SD_SECTOR_SIZE);
+  }
+}
+
+/**
+ * Takes a sector written by the Atari. Returns false if there was no room for it (which
+ * only happens when a dirty sector had to make way and couldn't be written out).
+ */
+boolean SectorCache::write(unsigned long sector, byte* data) {
+  if (!m_writeDelay) {
+    // (the cache keeps a clean copy of what was written)
+    if (m_image->writeSectorData(sector, data, SD_SECTOR_SIZE) != SD_SECTOR_SIZE) {
+      return false;
+    }
+    fill(sector, data);
+    return true;
+  }
+
+  CachedSector* slot = allocate(sector);
+  if (!slot) {
+    return false;
+  }
+
+  memcpy(slot->data, data, SD_SECTOR_SIZE);
+  if (!slot->dirty) {
+    slot->dirty = true;
+    m_dirtyCount++;
+  }
+  m_lastWrite = millis();
+  return true;
+}
+
+boolean SectorCache::isDirty() {
+  return (m_dirtyCount > 0);
+}
+
+/**
+ * Background task that writes one dirty sector to the image once the Atari has stopped
+ * writing for a while. Returns true when nothing is left to write.
+ */
+boolean SectorCache::writeBack() {
+  if (!m_dirtyCount) {
+    return true;
+  }
+  if (millis() - m_lastWrite < m_writeDelay) {
+    return false;
+  }
+
+  for (byte i=0; i < SECTOR_CACHE_SLOTS; i++) {
+    if (m_slots[i].dirty) {
+      writeSlot(&m_slots[i]);
+      break;
+    }
+  }
+  return (m_dirtyCount == 0);
+}
+
+/**
+ * Writes every dirty sector to the image right away (before it's unmounted). Returns
+ * false if any of them couldn't be written.
+ */
+boolean SectorCache::flush() {
+  boolean result = true;
+  for (byte i=0; i < SECTOR_CACHE_SLOTS; i++) {
+    if (m_slots[i].dirty && !writeSlot(&m_slots[i])) {
+      result = false;
+    }
+  }
+  return result;
+}
+
+boolean SectorCache::hasReadAhead() {
+  return (m_aheadNext && m_aheadNext <= m_aheadEnd);
+}
+
+/**
+ * Background task that reads the next sector of the read-ahead window into the cache.
+ * Returns true when the window has been read.
+ */
+boolean SectorCache::readAhead() {
+  if (hasReadAhead()) {
+    unsigned long sector = m_aheadNext++;
+    if (!find(sector)) {
+      byte data[SD_SECTOR_SIZE];
+      SectorDataInfo* info = m_image->getSectorData(sector, data);
+      if (!info->error) {
+        fill(sector, data);
+      }
+    }
+  }
+  return !hasReadAhead();
+}
+
+CachedSector* SectorCache::find(unsigned long sector) {
+  for (byte i=0; i < SECTOR_CACHE_SLOTS; i++) {
+    if (m_slots[i].sector == sector) {
+      return &m_slots[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Finds the slot for a sector, taking over the least recently used one if it isn't
+ * cached yet. Clean slots are given up before dirty ones, which have to be written out
+ * first.
+ */
+CachedSector* SectorCache::allocate(unsigned long sector) {
+  CachedSector* slot = find(sector);
+
+  if (!slot) {
+    unsigned int oldest = 0;
+    for (byte i=0; i < SECTOR_CACHE_SLOTS; i++) {
+      CachedSector* s = &m_slots[i];
+      if (!s->sector) {
+        slot = s;
+        break;
+      }
+      unsigned int age = m_useCounter - s->lastUse;
+      if (!slot || (slot->dirty && !s->dirty) || (slot->dirty == s->dirty && age > oldest)) {
+        slot = s;
+        oldest = age;
+      }
+    }
+
+    if (slot->dirty && !writeSlot(slot)) {
+      return NULL;
+    }
+    slot->sector = sector;
+  }
+
+  touch(slot);
+  return slot;
+}
+
+boolean SectorCache::writeSlot(CachedSector* slot) {
+  unsigned long written = m_image->writeSectorData(slot->sector, slot->data, SD_SECTOR_SIZE);
+
+  // (a sector the card won't take is dropped rather than retried forever)
+  if (written != SD_SECTOR_SIZE) {
+    LOG_MSG(F("Cache write-back failed: "));
+    LOG_MSG_CR(slot->sector);
+  }
+  slot->dirty = false;
+  m_dirtyCount--;
+  return (written == SD_SECTOR_SIZE);
+}
+
+void SectorCache::touch(CachedSector* slot) {
+  slot->lastUse = ++m_useCounter;
+}
+
+#endif
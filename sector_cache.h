@@ -0,0 +1,73 @@
+#ifndef SECTOR_CACHE_h
+#define SECTOR_CACHE_h
+
+#include <Arduino.h>
+#include "atari.h"
+#include "disk_image.h"
+
+// how many single density sectors are kept in RAM (128 bytes each)
+const byte SECTOR_CACHE_SLOTS            = 16;
+
+// written sectors only go out to the card once the Atari hasn't written anything for
+// this long (by default), so a DOS rewriting its VTOC for every sector of a file costs
+// one card write
+const unsigned int SECTOR_CACHE_WRITE_DELAY = 2000;
+
+// how far ahead of a run of sequential reads sectors are read into the cache (by default)
+const byte SECTOR_CACHE_READ_AHEAD       = 4;
+
+// the DOS 2 VTOC and directory, which are read into the cache when an image is mounted
+const unsigned int SECTOR_CACHE_PRELOAD_START = 360;
+const byte SECTOR_CACHE_PRELOAD_COUNT    = 9;
+
+struct CachedSector {
+  unsigned int  sector;    // 0 if the slot is free
+  boolean       dirty;
+  unsigned int  lastUse;
+  byte          data[SD_SECTOR_SIZE];
+};
+
+/**
+ * Keeps the most recently used sectors of a single density image in RAM. Reads of a
+ * cached sector never touch the card, and writes only update the cache; writeBack()
+ * moves dirty sectors out to the image later, while the bus is idle. Once the Atari is
+ * reading sectors in order, readAhead() fetches the next few the same way, so the card
+ * read for a sector is done before the Atari asks for it.
+ *
+ * Until then the card is behind the Atari, so anything written in the last couple of
+ * seconds is lost if the power goes.
+ */
+class SectorCache {
+public:
+  SectorCache(DiskImage* image);
+  void setTuning(byte readAhead, unsigned int writeDelay);
+  void clear();
+  void preload();
+  boolean read(unsigned long sector, byte* data);
+  void noteRead(unsigned long sector);
+  void fill(unsigned long sector, byte* data);
+  boolean write(unsigned long sector, byte* data);
+  boolean isDirty();
+  boolean writeBack();
+  boolean flush();
+  boolean hasReadAhead();
+  boolean readAhead();
+private:
+  CachedSector* find(unsigned long sector);
+  CachedSector* allocate(unsigned long sector);
+  boolean writeSlot(CachedSector* slot);
+  void touch(CachedSector* slot);
+
+  DiskImage*     m_image;
+  CachedSector   m_slots[SECTOR_CACHE_SLOTS];
+  unsigned int   m_useCounter;
+  byte           m_dirtyCount;
+  byte           m_readAhead;
+  unsigned int   m_writeDelay;
+  unsigned long  m_lastWrite;
+  unsigned int   m_lastRead;
+  unsigned int   m_aheadNext;
+  unsigned int   m_aheadEnd;
+};
+
+#endif
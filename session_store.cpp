@@ -0,0 +1,113 @@
+/*
+ * session_store.cpp - Keeps the mounted image in EEPROM across power cycles.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "session_store.h"
+#include "config.h"
+
+#ifdef SESSION_RESTORE
+#include <EEPROM.h>
+
+SessionStore::SessionStore() {
+  m_slot = SESSION_SLOTS - 1;
+  m_sequence = 0;
+  memset(&m_last, 0, sizeof(m_last));
+}
+
+/**
+ * Finds the newest valid session. This also picks up where the slot rotation left off,
+ * so it should be called before the first save. There's nothing to restore if the newest
+ * record is one that invalidated the session.
+ */
+boolean SessionStore::load(Session* session) {
+  SessionRecord record;
+  boolean found = false;
+
+  for (byte slot=0; slot < SESSION_SLOTS; slot++) {
+    if (readSlot(slot, &record)) {
+      // (compared so that the sequence numbers can wrap)
+      if (!found || (int)(record.sequence - m_sequence) > 0) {
+        found = true;
+        m_slot = slot;
+        m_sequence = record.sequence;
+        memcpy(&m_last, &record.session, sizeof(m_last));
+      }
+    }
+  }
+
+  if (!found || m_last.depth == SESSION_DEPTH_UNKNOWN) {
+    return false;
+  }
+  memcpy(session, &m_last, sizeof(m_last));
+  return true;
+}
+
+/**
+ * Writes the session to the next slot, unless it's the one already stored. A session
+ * whose path couldn't be kept is written as an invalidating record instead, so that an
+ * older slot isn't restored in its place.
+ */
+void SessionStore::save(Session* session) {
+  SessionRecord record;
+  memset(&record, 0, sizeof(record));
+  if (session->depth == SESSION_DEPTH_UNKNOWN) {
+    record.session.depth = SESSION_DEPTH_UNKNOWN;
+    session = &record.session;
+  }
+  if (!memcmp(session, &m_last, sizeof(m_last))) {
+    return;
+  }
+
+  record.sequence = m_sequence + 1;
+  if (record.sequence == SESSION_SEQ_ERASED) {
+    record.sequence = 0;
+  }
+  if (session != &record.session) {
+    memcpy(&record.session, session, sizeof(record.session));
+  }
+  record.checksum = checksum(&record);
+
+  m_slot = (m_slot + 1) % SESSION_SLOTS;
+  m_sequence = record.sequence;
+  memcpy(&m_last, session, sizeof(m_last));
+
+  // (put only writes the bytes that changed)
+  EEPROM.put(SESSION_EEPROM_BASE + m_slot * sizeof(SessionRecord), record);
+}
+
+boolean SessionStore::readSlot(byte slot, SessionRecord* record) {
+  EEPROM.get(SESSION_EEPROM_BASE + slot * sizeof(SessionRecord), *record);
+  return (record->sequence != SESSION_SEQ_ERASED &&
+          (record->session.depth <= SESSION_MAX_DEPTH ||
+           record->session.depth == SESSION_DEPTH_UNKNOWN) &&
+          record->checksum == checksum(record));
+}
+
+byte SessionStore::checksum(SessionRecord* record) {
+  // (rotating before each byte catches swapped bytes, which a plain sum wouldn't)
+  byte sum = 0;
+  byte* b = (byte*)record;
+  for (unsigned int i=0; i < offsetof(SessionRecord, checksum); i++) {
+    sum = (byte)((sum << 1) | (sum >> 7)) + b[i];
+  }
+  return sum;
+}
+#endif
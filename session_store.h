@@ -0,0 +1,53 @@
+#ifndef SESSION_STORE_h
+#define SESSION_STORE_h
+
+#include <Arduino.h>
+
+// where the session records start in EEPROM and how many of them the writes rotate
+// through (each slot takes sizeof(SessionRecord) bytes)
+#define SESSION_EEPROM_BASE   0
+#define SESSION_SLOTS         8
+
+#define SESSION_MAX_DEPTH     6
+#define SESSION_DEPTH_UNKNOWN 0xFF
+
+// an erased EEPROM reads back as 0xFF, so that sequence number is never written
+#define SESSION_SEQ_ERASED    0xFFFF
+
+/**
+ * What's needed to get back to the mounted image after a power cycle without walking
+ * any directories: the directory entry index of each directory from the root down, then
+ * that of the image file itself (its name is kept to make sure the card hasn't changed).
+ */
+struct Session {
+  byte depth;
+  unsigned int dirPath[SESSION_MAX_DEPTH];
+  unsigned int fileIndex;
+  char name[13];
+};
+
+struct SessionRecord {
+  unsigned int sequence;
+  Session session;
+  byte checksum;
+};
+
+/**
+ * Keeps the session in EEPROM. Every save goes to the next slot with a higher sequence
+ * number, spreading the wear over all of the slots; the newest valid slot wins on load.
+ */
+class SessionStore {
+public:
+  SessionStore();
+  boolean load(Session* session);
+  void save(Session* session);
+private:
+  boolean readSlot(byte slot, SessionRecord* record);
+  byte checksum(SessionRecord* record);
+
+  byte          m_slot;
+  unsigned int  m_sequence;
+  Session       m_last;
+};
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * settings.cpp - Reads runtime tuning from a file on the SD card.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "settings.h"
+#include "sio_timing.h"
+#include "sector_cache.h"
+#include "config.h"
+
+#ifdef SETTINGS_FILE
+
+/**
+ * Fills in the settings, starting from the defaults. Returns false if there's no
+ * settings file.
+ */
+boolean SettingsFile::load(Settings* settings) {
+  SdFile file;
+  char line[SETTINGS_LINE_SIZE];
+  byte len = 0;
+
+  setDefaults(settings);
+
+  if (!file.open(SETTINGS_FILENAME, O_READ)) {
+    return false;
+  }
+
+  int c;
+  do {
+    c = file.read();
+    if (c < 0 || c == '\n' || c == '\r') {
+      line[len] = 0;
+      if (len && line[0] != '#') {
+        parseLine(line, settings);
+      }
+      len = 0;
+    } else if (c != ' ' && c != '\t' && len < SETTINGS_LINE_SIZE - 1) {
+      line[len++] = toupper(c);
+    }
+  } while (c >= 0);
+
+  file.close();
+  return true;
+}
+
+void SettingsFile::setDefaults(Settings* settings) {
+  settings->sioBaudRate = SIO_BAUD_RATE;
+  settings->writeBackDelay = SECTOR_CACHE_WRITE_DELAY;
+  settings->timingProfile = TIMING_PROFILE;
+  settings->spiMHz = SD_SPI_MHZ;
+  settings->readAhead = SECTOR_CACHE_READ_AHEAD;
+}
+
+/**
+ * Applies one KEY=VALUE line. A key that isn't known or a value that's out of range is
+ * logged and otherwise ignored.
+ */
+void SettingsFile::parseLine(char* line, Settings* settings) {
+  char* value = strchr(line, '=');
+  if (!value) {
+    LOG_MSG(F("Bad setting: "));
+    LOG_MSG_CR(line);
+    return;
+  }
+  *(value++) = 0;
+  unsigned long n = strtoul(value, NULL, 10);
+
+  if (!strcmp_P(line, PSTR("BAUD")) && n > 0) {
+    settings->sioBaudRate = n;
+  } else if (!strcmp_P(line, PSTR("TIMING"))) {
+    if (!strcmp_P(value, PSTR("810"))) {
+      settings->timingProfile = TIMING_810;
+    } else if (!strcmp_P(value, PSTR("1050"))) {
+      settings->timingProfile = TIMING_1050;
+    } else if (!strcmp_P(value, PSTR("FAST"))) {
+      settings->timingProfile = TIMING_FAST;
+    } else {
+      LOG_MSG(F("Bad timing profile: "));
+      LOG_MSG_CR(value);
+    }
+  } else if (!strcmp_P(line, PSTR("SPI_MHZ")) && n > 0 && n <= SD_SPI_MHZ) {
+    settings->spiMHz = n;
+  } else if (!strcmp_P(line, PSTR("READ_AHEAD")) && n <= SECTOR_CACHE_SLOTS / 2) {
+    // (a window any bigger would push its own sectors out of the cache)
+    settings->readAhead = n;
+  } else if (!strcmp_P(line, PSTR("WRITE_BACK")) && n <= 0xFFFF) {
+    settings->writeBackDelay = n;
+  } else {
+    LOG_MSG(F("Bad setting: "));
+    LOG_MSG(line);
+    LOG_MSG('=');
+    LOG_MSG_CR(value);
+  }
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef SETTINGS_h
+#define SETTINGS_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+#define SETTINGS_FILENAME "/SIO2ARD.CFG"
+
+// the longest line read from the settings file (longer ones are cut off)
+const byte SETTINGS_LINE_SIZE        = 32;
+
+/**
+ * The tuning that can be changed without reflashing. Anything the settings file doesn't
+ * mention keeps its config.h default.
+ */
+struct Settings {
+  unsigned long  sioBaudRate;
+  unsigned int   writeBackDelay;   // ms the sector cache holds writes for (0 writes straight through)
+  byte           timingProfile;
+  byte           spiMHz;
+  byte           readAhead;        // sectors the sector cache reads ahead
+};
+
+/**
+ * Reads the settings file at startup. It's plain text with one KEY=VALUE per line
+ * (lines starting with # are comments):
+ *
+ *   BAUD=19200        SIO bus rate
+ *   TIMING=1050       SIO timing profile (810, 1050 or FAST)
+ *   SPI_MHZ=25        SD card clock
+ *   READ_AHEAD=4      sector cache read-ahead (0 turns it off)
+ *   WRITE_BACK=2000   how long the sector cache holds writes (0 writes through)
+ */
+class SettingsFile {
+public:
+  boolean load(Settings* settings);
+private:
+  void setDefaults(Settings* settings);
+  void parseLine(char* line, Settings* settings);
+};
+
+#endif
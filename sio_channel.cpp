@@ -23,13 +23,23 @@
 #include "sio_channel.h"
 #include "config.h"
 
-SIOChannel::SIOChannel(int cmdPin, Stream* stream, DriveAccess *driveAccess, DriveControl *driveControl) {
+SIOChannel::SIOChannel(int cmdPin, Stream* stream) {
   m_cmdPin = cmdPin;
   m_stream = stream;
-  m_driveAccess = driveAccess;
-  m_driveControl = driveControl;
-  
-  m_sdriveHandler.setDriveControl(m_driveControl);
+  m_deviceCount = 0;
+  m_concurrentDevice = NULL;
+#ifdef SIO_STATS
+  m_stats = NULL;
+#endif
+#ifdef MEMORY_PROBE
+  m_memoryProbe = NULL;
+#endif
+
+  // recognize command frames for the other drives and R1: on a shared bus they have to
+  // be read (and ignored) as frames so their bytes aren't mistaken for one of ours
+  memset(m_deviceIds, 0, sizeof(m_deviceIds));
+  markDeviceIds(DEVICE_D1, 8);
+  markDeviceIds(DEVICE_R1, 1);
 
   // set command pin to be read
   pinMode(m_cmdPin, INPUT);
@@ -37,16 +47,52 @@ SIOChannel::SIOChannel(int cmdPin, Stream* stream, DriveAccess *driveAccess, Dri
   m_cmdPinState = STATE_INIT;
 }
 
+/**
+ * Registers a device to answer commands on the bus.
+ */
+boolean SIOChannel::addDevice(SIODevice* device) {
+  if (m_deviceCount == MAX_SIO_DEVICES) {
+    return false;
+  }
+
+  device->setTiming(&m_timing);
+#ifdef SIO_STATS
+  device->setStats(m_stats);
+#endif
+  markDeviceIds(device->getFirstDeviceId(), device->getDeviceCount());
+  m_devices[m_deviceCount++] = device;
+
+  return true;
+}
+
+#ifdef SIO_STATS
+/**
+ * Sets where bus statistics are collected (this must happen before devices are added).
+ */
+void SIOChannel::setStats(SIOStats* stats) {
+  m_stats = stats;
+}
+#endif
+
+#ifdef MEMORY_PROBE
+/**
+ * Sets the probe that's sampled after every command.
+ */
+void SIOChannel::setMemoryProbe(MemoryProbe* probe) {
+  m_memoryProbe = probe;
+}
+#endif
+
 void SIOChannel::runCycle() {
     // watch the Atari command line
     switch (m_cmdPinState) {
       case STATE_INIT:
-        if (digitalRead(m_cmdPin) == HIGH) {
+        if (!isCommandAsserted()) {
           m_cmdPinState = STATE_WAIT_CMD_START;
         }
         break;
       case STATE_WAIT_CMD_START:
-        if (digitalRead(m_cmdPin) == LOW) {
+        if (isCommandAsserted()) {
           m_cmdPinState = STATE_READ_CMD;
           resetCommandFrameBuffer();
         }
@@ -55,13 +101,24 @@ void SIOChannel::runCycle() {
         m_startTimeoutInterval = millis();
         // if command frame is fully read...
         if (m_cmdFramePtr - (byte*)&m_cmdFrame == COMMAND_FRAME_SIZE) {
+          // the response timing starts when the command line goes high again (if it
+          // never does, the last byte's mark stands and the wait already covers T2)
+          if (isCommandAsserted()) {
+            if (m_timing.sinceMark() < CMD_DEASSERT_TIMEOUT) {
+              break;
+            }
+          } else {
+            m_timing.mark();
+          }
           dumpCommandFrame();
           // process command frame
-          if (isChecksumValid() && isCommandForThisDevice()) {
-            if (isValidCommand() && isValidAuxData()) {
-              m_cmdPinState = processCommand();
+          SIODevice* device = findDevice(m_cmdFrame.deviceId);
+          if (isChecksumValid() && device != NULL) {
+            if (device->isValidCommand(m_cmdFrame.command) && isValidAuxData()) {
+              m_cmdPinState = processCommand(device);
             } else {
               m_stream->write(NAK);
+              STATS_COUNT(STAT_COUNT_NAK);
               m_cmdPinState = STATE_WAIT_CMD_START;
             }
           } else {
@@ -69,23 +126,47 @@ void SIOChannel::runCycle() {
           }
         // otherwise, check for command read timeout
         } else if (millis() - m_startTimeoutInterval > READ_CMD_TIMEOUT) {
+          STATS_COUNT(STAT_COUNT_CMD_TIMEOUT);
           m_cmdPinState = STATE_WAIT_CMD_START;
         }
         break;
       case STATE_READ_DATAFRAME:
         // check for timeout
         if (millis() - m_startTimeoutInterval > READ_FRAME_TIMEOUT) {
+          STATS_COUNT(STAT_COUNT_DATA_TIMEOUT);
           m_cmdPinState = STATE_WAIT_CMD_START;
         }
         break;
       case STATE_WAIT_CMD_END:
-        if (digitalRead(m_cmdPin) == HIGH) {
+        if (!isCommandAsserted()) {
           m_cmdPinState = STATE_WAIT_CMD_START;
         }
         break;      
+      case STATE_CONCURRENT:
+        // the Atari leaves concurrent mode by sending a command
+        if (isCommandAsserted()) {
+          m_concurrentDevice->endConcurrent();
+          m_concurrentDevice = NULL;
+          m_cmdPinState = STATE_READ_CMD;
+          resetCommandFrameBuffer();
+        } else {
+          m_concurrentDevice->runConcurrent(m_stream);
+        }
+        break;
     }
 }
 
+/**
+ * Returns true between commands, when there's time for slow housekeeping.
+ */
+boolean SIOChannel::isIdle() {
+  return (m_cmdPinState == STATE_WAIT_CMD_START && !isCommandAsserted());
+}
+
+SIOTiming* SIOChannel::getTiming() {
+  return &m_timing;
+}
+
 void SIOChannel::processIncomingByte() {
   // read the next byte from the bus
   byte b = m_stream->read();
@@ -96,7 +177,7 @@ void SIOChannel::processIncomingByte() {
     case STATE_INIT:
     case STATE_WAIT_CMD_START:
     case STATE_WAIT_CMD_END:
-      if (digitalRead(m_cmdPin) == LOW && isValidDevice(b)) {
+      if (isCommandAsserted() && isValidDevice(b)) {
         m_cmdPinState = STATE_READ_CMD;
         resetCommandFrameBuffer();
       } else {
@@ -105,27 +186,36 @@ void SIOChannel::processIncomingByte() {
     // if we're reading a command frame...
     case STATE_READ_CMD: {
       // read the data into the command frame
-      int idx = (int)m_cmdFramePtr - (int)&m_cmdFrame;
+      int idx = m_cmdFramePtr - (byte*)&m_cmdFrame;
       // sometimes we see extra bytes between command frames on the bus while reading a command and things get lost --
       // the isValidDevice() check prevents a command frame read from getting corrupted by them
       if (idx < COMMAND_FRAME_SIZE && (idx > 0 || (idx == 0 && isValidDevice(b)))) {
         *m_cmdFramePtr = b;
         m_cmdFramePtr++;
+        // (until the command line goes high, the timing runs from the last byte)
+        if (idx == COMMAND_FRAME_SIZE - 1) {
+          m_timing.mark();
+        }
         return;
       }
       break;
     }
     // if we're reading a data frame...
     case STATE_READ_DATAFRAME: {
-      // add byte to read sector buffer
+      // add byte to the device's data frame buffer
       *m_putSectorBufferPtr = b;
       m_putSectorBufferPtr++;
       m_putBytesRemaining--;
       if (m_putBytesRemaining == 0) {
-        doPutSector();
+        m_timing.mark();
+        processDataFrame();
       }
       break;
     }
+    // in concurrent mode everything goes to the device
+    case STATE_CONCURRENT:
+      m_concurrentDevice->processConcurrentByte(b, m_stream);
+      break;
     default:
       LOG_MSG(F("Ignoring byte "));
       LOG_MSG(b, HEX);
@@ -135,13 +225,34 @@ void SIOChannel::processIncomingByte() {
   }
 }
 
+void SIOChannel::markDeviceIds(byte firstDeviceId, byte count) {
+  for (byte id=firstDeviceId; count > 0; id++, count--) {
+    m_deviceIds[id >> 3] |= (1 << (id & 7));
+  }
+}
+
+SIODevice* SIOChannel::findDevice(byte deviceId) {
+  for (byte i=0; i < m_deviceCount; i++) {
+    if (m_devices[i]->hasDeviceId(deviceId)) {
+      return m_devices[i];
+    }
+  }
+  return NULL;
+}
+
+boolean SIOChannel::isCommandAsserted() {
+  // the command line is active low
+  return (digitalRead(m_cmdPin) == LOW);
+}
+
 boolean SIOChannel::isChecksumValid() {
-  byte chkSum = checksum((byte*)&m_cmdFrame, 4);
+  byte chkSum = SIODevice::checksum((byte*)&m_cmdFrame, 4);
   if (chkSum != m_cmdFrame.checksum) {
     LOG_MSG(F("Checksum failed. Calculated: "));
     LOG_MSG(chkSum);
     LOG_MSG(F("; received: "));
     LOG_MSG_CR(m_cmdFrame.checksum);
+    STATS_COUNT(STAT_COUNT_CMD_CHECKSUM);
 
     return false;
   } else {
@@ -149,225 +260,71 @@ boolean SIOChannel::isChecksumValid() {
   }
 }
 
-boolean SIOChannel::isCommandForThisDevice() {
-  // we only emulate drive 1 right now
-  return (m_cmdFrame.deviceId == DEVICE_D1 || m_cmdFrame.deviceId == DEVICE_SDRIVE);
-}
-
-boolean SIOChannel::isValidCommand() {
-  boolean result = (m_cmdFrame.command == CMD_READ || 
-                    m_cmdFrame.command == CMD_WRITE ||
-                    m_cmdFrame.command == CMD_STATUS ||
-                    m_cmdFrame.command == CMD_PUT ||
-                    m_cmdFrame.command == CMD_FORMAT ||
-                    m_cmdFrame.command == CMD_FORMAT_MD);
-
-  if (!result) {
-    result = m_sdriveHandler.isValidCommand(m_cmdFrame.command);
-  }
-  
-  return result;
-}
-
 boolean SIOChannel::isValidDevice(byte b) {
-  boolean result = (b == DEVICE_D1 ||
-                    b == DEVICE_D2 ||
-                    b == DEVICE_D3 ||
-                    b == DEVICE_D4 ||
-                    b == DEVICE_D5 ||
-                    b == DEVICE_D6 ||
-                    b == DEVICE_D7 ||
-                    b == DEVICE_D8 ||
-                    b == DEVICE_R1);
-
-  if (!result) {
-    result = m_sdriveHandler.isValidDevice(b);
-  }
-  
-  return result;
+  // this runs for every byte seen while waiting for a command, so it's a bitmap lookup
+  return (m_deviceIds[b >> 3] & (1 << (b & 7))) != 0;
 }
 
 boolean SIOChannel::isValidAuxData() {
   return true;
 }
 
-byte SIOChannel::checksum(byte* chunk, int length) {
-  int chkSum = 0;
-  for(int i=0; i < length; i++) {
-    chkSum = ((chkSum+chunk[i])>>8) + ((chkSum+chunk[i])&0xff);
+byte SIOChannel::processCommand(SIODevice* device) {
+  int length = device->processCommand(&m_cmdFrame, m_stream);
+
+#ifdef MEMORY_PROBE
+  // the response has been sent, so there's time to see how deep the command went
+  m_memoryProbe->sample(&m_cmdFrame);
+#endif
+
+  // if the device wants a data frame, collect it for the device
+  if (length > 0) {
+    m_dataFrameDevice = device;
+    m_dataFrameBuffer = device->getDataFrameBuffer();
+    m_putSectorBufferPtr = m_dataFrameBuffer;
+    m_putBytesRemaining = length;
+    m_startTimeoutInterval = millis();
+    return STATE_READ_DATAFRAME;
   }
-  return (byte)chkSum;
-}
 
-byte SIOChannel::processCommand() {
-  int deviceId = 1;
-  byte nextCmdPinState = STATE_WAIT_CMD_END;
-  
-  switch (m_cmdFrame.command) {
-    case CMD_READ:
-      cmdGetSector(deviceId);
-      break;
-    case CMD_WRITE:
-    case CMD_PUT:
-      cmdPutSector(deviceId);
-      nextCmdPinState = STATE_READ_DATAFRAME;
-      m_startTimeoutInterval = millis();
-      break;
-    case CMD_STATUS:
-      cmdGetStatus(deviceId);
-      break;
-    case CMD_FORMAT:
-      cmdFormat(deviceId, DENSITY_SD);
-      break;
-    case CMD_FORMAT_MD:
-      cmdFormat(deviceId, DENSITY_ED);
-      break;
-    default:
-      m_sdriveHandler.processCommand(&m_cmdFrame, m_stream);
-      break;
-  }
-  
-  return nextCmdPinState;
-}
-
-void SIOChannel::cmdGetSector(int deviceId) {
-  // send ACK
-  delay(DELAY_T2);
-  m_stream->write(ACK);
-
-  // write data frame + checksum
-  SectorDataInfo *p = m_driveAccess->readSectorFunc(deviceId, getCommandSector(), (byte*)&m_sectorBuffer);
-  if (p != NULL && !p->error) {
-    // send complete 
-    delay(DELAY_T5);
-    m_stream->write(COMPLETE);
-  } else {
-    // send error
-    delay(DELAY_T5);
-    m_stream->write(ERR);
-  }
-
-  m_stream->flush();
-
-  delayMicroseconds(700);
-
-  if (p != NULL) {
-    byte *b = (byte*)&m_sectorBuffer;
-    // write data
-    for (int i=0; i < p->length; i++) {
-      m_stream->write(*b);
-      b++;
-    }
-    // write checksum
-    m_stream->write(checksum((byte*)&m_sectorBuffer, p->length));
-  } else {
-    // write empty data + checksum
-    for (int i=0; i < SD_SECTOR_SIZE + 1; i++) {
-      m_stream->write((byte)0x00);
-    }
+  if (length == CONCURRENT_MODE) {
+    m_concurrentDevice = device;
+    return STATE_CONCURRENT;
   }
 
-  m_stream->flush();
+  return STATE_WAIT_CMD_END;
 }
 
-void SIOChannel::cmdPutSector(int deviceId) {
-  // send ACK
-  delay(DELAY_T2);
-  m_stream->write(ACK);
-
-  DriveStatus *status = m_driveAccess->deviceStatusFunc(deviceId);
-  m_putBytesRemaining = status->sectorSize + 1;
-  m_putSectorBufferPtr = m_sectorBuffer;
-}
-  
-void SIOChannel::doPutSector() {
-  int sectorSize = m_putSectorBufferPtr - m_sectorBuffer - 1;
+void SIOChannel::processDataFrame() {
+  int length = m_putSectorBufferPtr - m_dataFrameBuffer - 1;
 
   // calculate checksum
-  byte chksum = checksum(m_sectorBuffer, sectorSize);
-
-  // if checksum is good...
-  if (m_sectorBuffer[sectorSize] == chksum) {
-    // send ACK
-    delay(DELAY_T4);
-    m_stream->write(ACK);
-
-    // write sector to disk image
-    delay(DELAY_T5);
-    if (m_driveAccess->writeSectorFunc(1, getCommandSector(), m_sectorBuffer, sectorSize)) {
-      // send COMPLETE
-      m_stream->write(COMPLETE);
-    } else {
-      LOG_MSG_CR(F("Write to device error"));
-      m_stream->write(ERR);
-    }
+  byte chksum = SIODevice::checksum(m_dataFrameBuffer, length);
+
+  // if checksum is good, hand the frame to the device...
+  if (m_dataFrameBuffer[length] == chksum) {
+    m_dataFrameDevice->processDataFrame(&m_cmdFrame, length, m_stream);
   // otherwise, NAK it
   } else {
-    delay(DELAY_T4);
+    m_timing.waitFor(TIMING_T4);
     m_stream->write(NAK);
+    STATS_COUNT(STAT_COUNT_NAK);
+    STATS_COUNT(STAT_COUNT_DATA_CHECKSUM);
 
     LOG_MSG(F("Data frame checksum error: "));
     LOG_MSG(chksum, HEX);
     LOG_MSG(F(" vs. "));
-    LOG_MSG_CR(m_sectorBuffer[sectorSize], HEX);
+    LOG_MSG_CR(m_dataFrameBuffer[length], HEX);
   }
 
+#ifdef MEMORY_PROBE
+  m_memoryProbe->sample(&m_cmdFrame);
+#endif
+
   // change state
   m_cmdPinState = STATE_WAIT_CMD_START;
 }
 
-void SIOChannel::cmdGetStatus(int deviceId) {
-  // send ACK
-  delay(DELAY_T2);
-  m_stream->write(ACK);
-
-  // send complete 
-  delay(DELAY_T5);
-  m_stream->write(COMPLETE);
-
-  // get device status
-  DriveStatus* driveStatus = m_driveAccess->deviceStatusFunc(deviceId);
-
-  // calculate checksum
-  int frameLength = sizeof(driveStatus->statusFrame);
-  byte chksum = checksum((byte*)&driveStatus->statusFrame, frameLength);
-
-  // send status to bus
-  byte* b = (byte*)&driveStatus->statusFrame;
-  for (int i=0; i < frameLength; i++) {
-    m_stream->write(*b);
-    b++;
-  }
-  m_stream->write(chksum);
-}
-
-void SIOChannel::cmdFormat(int deviceId, int density) {
-  // send ACK
-  delay(DELAY_T2);
-  m_stream->write(ACK);
-
-  // perform image format
-  if (m_driveAccess->formatFunc(deviceId, density)) {
-    // send COMPLETE
-    delay(DELAY_T5);
-    m_stream->write(COMPLETE);
-    
-    LOG_MSG(F("Sending data frame of length "));
-    LOG_MSG_CR(SD_SECTOR_SIZE);
-
-    m_stream->write(0xFF);
-    m_stream->write(0xFF);
-    for (int i=0; i < SD_SECTOR_SIZE - 3; i++) {
-      m_stream->write((byte)0x00);
-    }
-    m_stream->write(0xFF);
-    m_stream->write(0xFF);
-  } else {
-    delay(DELAY_T5);
-    m_stream->write(ERR);
-  }
-}
-
 void SIOChannel::dumpCommandFrame() {
 // we only compile this on DEBUG to save allocating string constants
 #ifdef DEBUG
@@ -381,48 +338,23 @@ void SIOChannel::dumpCommandFrame() {
   LOG_MSG(F(" "));
   LOG_MSG(m_cmdFrame.checksum, HEX);
   LOG_MSG(F(" : "));
-  
-  switch (m_cmdFrame.command) {
-    case CMD_STATUS:
-      LOG_MSG(F("STATUS"));
-      break;
-    case CMD_POLL:
-      LOG_MSG(F("POLL"));
-      break;
-    case CMD_READ:
-      LOG_MSG(F("READ "));
-      LOG_MSG(getCommandSector());
-      break;
-    case CMD_WRITE:
-      LOG_MSG(F("WRITE "));
-      LOG_MSG(getCommandSector());
-      break;
-    case CMD_PUT:
-      LOG_MSG(F("PUT "));
-      LOG_MSG(getCommandSector());
-      break;
-    case CMD_FORMAT:
-      LOG_MSG(F("FORMAT"));
-      break;
-    case CMD_FORMAT_MD:
-      LOG_MSG(F("FORMAT MD"));
-      break;
-    default:
-      if (!m_sdriveHandler.printCmdName(m_cmdFrame.command)) {
-        LOG_MSG(F("??"));
-      }
+
+  SIODevice* device = findDevice(m_cmdFrame.deviceId);
+  if (device == NULL || !device->printCmdName(&m_cmdFrame)) {
+    LOG_MSG(F("??"));
   }
   
   LOG_MSG_CR();
 #endif  
 }
 
-unsigned long SIOChannel::getCommandSector() {
-  return (unsigned long)(m_cmdFrame.aux2 << 8) + (m_cmdFrame.aux1 & 0xff);
-}
-
 void SIOChannel::resetCommandFrameBuffer() {
   // reset last command frame info
   memset(&m_cmdFrame, 0, sizeof(m_cmdFrame));
   m_cmdFramePtr = (byte*)&m_cmdFrame;
+
+#ifdef SIO_STATS
+  // this happens as soon as the command line is seen going low
+  m_stats->markCommandStart();
+#endif
 }
@@ -3,9 +3,12 @@
 
 #include <Arduino.h>
 #include "atari.h"
-#include "drive_access.h"
-#include "drive_control.h"
-#include "sdrive.h"
+#include "config.h"
+#include "sio_device.h"
+#include "sio_timing.h"
+#ifdef MEMORY_PROBE
+#include "memory_probe.h"
+#endif
 
 const byte COMMAND_FRAME_SIZE   = 5;
 
@@ -14,17 +17,13 @@ const byte STATE_WAIT_CMD_START = 2;
 const byte STATE_READ_CMD       = 3;
 const byte STATE_READ_DATAFRAME = 4;
 const byte STATE_WAIT_CMD_END   = 5;
-
-const byte CMD_FORMAT           = 0x21;
-const byte CMD_FORMAT_MD        = 0x22;
-const byte CMD_POLL             = 0x3F;
-const byte CMD_PUT              = 0x50;
-const byte CMD_READ             = 0x52;
-const byte CMD_STATUS           = 0x53;
-const byte CMD_WRITE            = 0x57;
+const byte STATE_CONCURRENT     = 6;
 
 const unsigned long READ_CMD_TIMEOUT     = 500;
 const unsigned long READ_FRAME_TIMEOUT   = 2000;
+// how long after the last command frame byte to wait for the command line to go high
+// (the Atari deasserts it 650-950us after that byte)
+const unsigned long CMD_DEASSERT_TIMEOUT = 2000;
 
 const byte DEVICE_D1            = 0x31;
 const byte DEVICE_D2            = 0x32;
@@ -36,29 +35,36 @@ const byte DEVICE_D7            = 0x37;
 const byte DEVICE_D8            = 0x38;
 const byte DEVICE_R1            = 0x50;
 
+const byte MAX_SIO_DEVICES      = 6;
+
+/**
+ * Handles the SIO bus framing (command line, command frames, data frames and timeouts)
+ * and dispatches commands to the devices registered with addDevice().
+ */
 class SIOChannel {
 public:
-  SIOChannel(int cmdPin, Stream* stream, DriveAccess *driveAccess, DriveControl *driveControl);
+  SIOChannel(int cmdPin, Stream* stream);
+  boolean addDevice(SIODevice* device);
+#ifdef SIO_STATS
+  void setStats(SIOStats* stats);
+#endif
+#ifdef MEMORY_PROBE
+  void setMemoryProbe(MemoryProbe* probe);
+#endif
   void runCycle();
+  boolean isIdle();
+  SIOTiming* getTiming();
   void processIncomingByte();
-  void sendDeviceStatus(DriveStatus *deviceStatus);
-  byte* readSectorDataFrame();
 private:
+  void markDeviceIds(byte firstDeviceId, byte count);
+  SIODevice* findDevice(byte deviceId);
+  boolean isCommandAsserted();
   boolean isChecksumValid();
-  boolean isCommandForThisDevice();
   boolean isValidDevice(byte b);
-  boolean isValidCommand();
   boolean isValidAuxData();
-  byte checksum(byte* chunk, int size);
-  byte processCommand();
+  byte processCommand(SIODevice* device);
+  void processDataFrame();
   void dumpCommandFrame();
-  void cmdGetSector(int deviceId);
-  void cmdPutSector(int deviceId);
-  void cmdPutSectorWithVerify(int deviceId);
-  void cmdGetStatus(int deviceId);
-  void cmdFormat(int deviceId, int density);
-  unsigned long getCommandSector();
-  void doPutSector();
   void resetCommandFrameBuffer();
 
   int               m_cmdPin;
@@ -66,13 +72,22 @@ private:
   byte              m_cmdPinState;
   CommandFrame      m_cmdFrame;
   byte*             m_cmdFramePtr;
-  byte              m_sectorBuffer[MAX_SECTOR_SIZE + 1];
+  byte              m_deviceIds[32];
+  SIODevice*        m_devices[MAX_SIO_DEVICES];
+  byte              m_deviceCount;
+  SIODevice*        m_dataFrameDevice;
+  SIODevice*        m_concurrentDevice;
+  byte*             m_dataFrameBuffer;
   byte*             m_putSectorBufferPtr;
   int               m_putBytesRemaining;
-  DriveAccess*      m_driveAccess;
-  DriveControl*     m_driveControl;
-  SDriveHandler     m_sdriveHandler;
+  SIOTiming         m_timing;
   unsigned long     m_startTimeoutInterval;
+#ifdef SIO_STATS
+  SIOStats*         m_stats;
+#endif
+#ifdef MEMORY_PROBE
+  MemoryProbe*      m_memoryProbe;
+#endif
 };
 
 #endif
@@ -0,0 +1,99 @@
+/*
+ * sio_device.cpp - The base class for devices on the SIO bus.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sio_device.h"
+#include "config.h"
+
+SIODevice::SIODevice(byte firstDeviceId, byte deviceCount, const byte* commands) {
+  m_firstDeviceId = firstDeviceId;
+  m_deviceCount = deviceCount;
+  m_commands = commands;
+  m_timing = NULL;
+#ifdef SIO_STATS
+  m_stats = NULL;
+#endif
+}
+
+boolean SIODevice::hasDeviceId(byte deviceId) {
+  return (deviceId >= m_firstDeviceId && deviceId - m_firstDeviceId < m_deviceCount);
+}
+
+boolean SIODevice::isValidCommand(byte cmd) {
+  const byte* p = m_commands;
+  byte c;
+  while ((c = pgm_read_byte(p++)) != 0) {
+    if (c == cmd) {
+      return true;
+    }
+  }
+  return false;
+}
+
+byte SIODevice::getFirstDeviceId() {
+  return m_firstDeviceId;
+}
+
+byte SIODevice::getDeviceCount() {
+  return m_deviceCount;
+}
+
+void SIODevice::setTiming(SIOTiming* timing) {
+  m_timing = timing;
+}
+
+#ifdef SIO_STATS
+void SIODevice::setStats(SIOStats* stats) {
+  m_stats = stats;
+}
+#endif
+
+byte* SIODevice::getDataFrameBuffer() {
+  return NULL;
+}
+
+void SIODevice::processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream) {
+}
+
+void SIODevice::processConcurrentByte(byte b, Stream* stream) {
+}
+
+void SIODevice::runConcurrent(Stream* stream) {
+}
+
+void SIODevice::endConcurrent() {
+}
+
+boolean SIODevice::printCmdName(CommandFrame* cmdFrame) {
+  return false;
+}
+
+/**
+ * Calculates the SIO checksum of a chunk. A frame sent in pieces can be checksummed by
+ * passing the checksum of the previous pieces as the start value.
+ */
+byte SIODevice::checksum(byte* chunk, int length, byte start) {
+  int chkSum = start;
+  for(int i=0; i < length; i++) {
+    chkSum = ((chkSum+chunk[i])>>8) + ((chkSum+chunk[i])&0xff);
+  }
+  return (byte)chkSum;
+}
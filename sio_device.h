@@ -0,0 +1,62 @@
+#ifndef SIO_DEVICE_h
+#define SIO_DEVICE_h
+
+#include <Arduino.h>
+#include "atari.h"
+#include "config.h"
+#include "sio_timing.h"
+#ifdef SIO_STATS
+#include "sio_stats.h"
+#endif
+
+#ifdef SIO_STATS
+  #define STATS_MARK(t) unsigned long t = micros()
+  #define STATS_RECORD(cmdClass, metric, start) m_stats->record(cmdClass, metric, micros() - (start))
+  #define STATS_COUNT(counter) m_stats->count(counter)
+#else
+  #define STATS_MARK(t)
+  #define STATS_RECORD(cmdClass, metric, start)
+  #define STATS_COUNT(counter)
+#endif
+
+// returned by processCommand() to take the bus over for concurrent mode: from then on the
+// device gets every byte the Atari sends until the command line is next asserted
+const int CONCURRENT_MODE = -1;
+
+/**
+ * A device on the SIO bus. A device answers to a range of device IDs and accepts the
+ * commands listed in a zero-terminated table in flash; the SIO channel takes care of
+ * the command and data frames and hands the device everything in between.
+ */
+class SIODevice {
+public:
+  SIODevice(byte firstDeviceId, byte deviceCount, const byte* commands);
+  boolean hasDeviceId(byte deviceId);
+  boolean isValidCommand(byte cmd);
+  byte getFirstDeviceId();
+  byte getDeviceCount();
+  void setTiming(SIOTiming* timing);
+#ifdef SIO_STATS
+  void setStats(SIOStats* stats);
+#endif
+  // handles a command frame and returns the length of the data frame (checksum included)
+  // the channel should read next, or 0 if there is none
+  virtual int processCommand(CommandFrame* cmdFrame, Stream* stream) = 0;
+  virtual byte* getDataFrameBuffer();
+  virtual void processDataFrame(CommandFrame* cmdFrame, int length, Stream* stream);
+  virtual void processConcurrentByte(byte b, Stream* stream);
+  virtual void runConcurrent(Stream* stream);
+  virtual void endConcurrent();
+  virtual boolean printCmdName(CommandFrame* cmdFrame);
+  static byte checksum(byte* chunk, int length, byte start = 0);
+protected:
+  byte        m_firstDeviceId;
+  byte        m_deviceCount;
+  const byte* m_commands;
+  SIOTiming*  m_timing;
+#ifdef SIO_STATS
+  SIOStats*   m_stats;
+#endif
+};
+
+#endif
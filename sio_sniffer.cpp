@@ -0,0 +1,126 @@
+/*
+ * sio_sniffer.cpp - Records SIO bus traffic to the SD card.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sio_sniffer.h"
+#include "config.h"
+
+SIOSniffer::SIOSniffer(Stream* stream, int cmdPin) {
+  m_stream = stream;
+  m_cmdPin = cmdPin;
+  m_active = 0;
+  m_full[0] = false;
+  m_full[1] = false;
+  m_blocks[0].count = 0;
+  m_blocks[1].count = 0;
+  m_dropped = 0;
+}
+
+/**
+ * Opens the trace file (new traces are appended to it).
+ */
+boolean SIOSniffer::begin() {
+  return m_file.open(SNIFFER_FILENAME, O_WRONLY | O_CREAT | O_APPEND);
+}
+
+/**
+ * Writes any filled block to the trace file. This should be called from loop() --
+ * it does nothing while the command line is asserted so the card write never
+ * delays a response.
+ */
+void SIOSniffer::service() {
+  if (!m_file.isOpen() || digitalRead(m_cmdPin) == LOW) {
+    return;
+  }
+
+  // don't let a partial block sit in memory once the bus goes quiet
+  if (!m_full[m_active] && m_blocks[m_active].count > 0 && millis() - m_lastRecordTime > SNIFFER_IDLE_FLUSH) {
+    swapBlocks();
+  }
+
+  for (byte i=0; i < 2; i++) {
+    if (m_full[i]) {
+      m_file.write((byte*)&m_blocks[i], sizeof(SnifferBlock));
+      m_file.sync();
+      m_blocks[i].count = 0;
+      m_full[i] = false;
+    }
+  }
+
+  if (m_dropped) {
+    LOG_MSG(F("Sniffer dropped bytes: "));
+    LOG_MSG_CR(m_dropped);
+    m_dropped = 0;
+  }
+}
+
+int SIOSniffer::available() {
+  return m_stream->available();
+}
+
+int SIOSniffer::read() {
+  // (incoming bytes are stamped when they're read, which can lag their arrival
+  // while a response is being sent)
+  int b = m_stream->read();
+  if (b != -1) {
+    record(b, 0);
+  }
+  return b;
+}
+
+int SIOSniffer::peek() {
+  return m_stream->peek();
+}
+
+size_t SIOSniffer::write(uint8_t b) {
+  size_t result = m_stream->write(b);
+  record(b, SNIFFER_FLAG_OUT);
+  return result;
+}
+
+void SIOSniffer::flush() {
+  m_stream->flush();
+}
+
+void SIOSniffer::record(byte b, byte flags) {
+  SnifferBlock *block = &m_blocks[m_active];
+
+  // if both blocks are waiting to be written, the byte is lost
+  if (m_full[m_active]) {
+    m_dropped++;
+    return;
+  }
+
+  SnifferRecord *r = &block->records[block->count++];
+  r->time = micros();
+  r->data = b;
+  r->flags = flags | (digitalRead(m_cmdPin) == LOW ? SNIFFER_FLAG_CMD : 0);
+  m_lastRecordTime = millis();
+
+  if (block->count == SNIFFER_RECORDS_PER_BLOCK) {
+    swapBlocks();
+  }
+}
+
+void SIOSniffer::swapBlocks() {
+  m_full[m_active] = true;
+  m_active = !m_active;
+}
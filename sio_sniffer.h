@@ -0,0 +1,56 @@
+#ifndef SIO_SNIFFER_h
+#define SIO_SNIFFER_h
+
+#include <Arduino.h>
+#include <SdFat.h>
+
+#define SNIFFER_FILENAME "/SIOTRACE.BIN"
+
+const byte SNIFFER_RECORDS_PER_BLOCK  = 85;
+const unsigned long SNIFFER_IDLE_FLUSH = 1000;
+
+// record flags
+const byte SNIFFER_FLAG_OUT = 0x01;   // the byte was sent by us (otherwise it was read from the bus)
+const byte SNIFFER_FLAG_CMD = 0x02;   // the command line was asserted
+
+struct SnifferRecord {
+  unsigned long time;
+  byte          data;
+  byte          flags;
+};
+
+// one 512 byte block of the trace file
+struct SnifferBlock {
+  unsigned int  count;
+  SnifferRecord records[SNIFFER_RECORDS_PER_BLOCK];
+};
+
+/**
+ * A Stream that sits between the SIO channel and the UART and records every byte
+ * passing through it, in either direction, to a trace file on the SD card.
+ */
+class SIOSniffer : public Stream {
+public:
+  SIOSniffer(Stream* stream, int cmdPin);
+  boolean begin();
+  void service();
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t b);
+  void flush();
+private:
+  void record(byte b, byte flags);
+  void swapBlocks();
+
+  Stream*       m_stream;
+  int           m_cmdPin;
+  SdFile        m_file;
+  SnifferBlock  m_blocks[2];
+  byte          m_active;
+  boolean       m_full[2];
+  unsigned long m_lastRecordTime;
+  unsigned int  m_dropped;
+};
+
+#endif
@@ -0,0 +1,136 @@
+/*
+ * sio_stats.cpp - Collects SIO timing and error statistics.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sio_stats.h"
+#include "config.h"
+
+SIOStats::SIOStats() {
+  reset();
+}
+
+void SIOStats::reset() {
+  memset(m_counters, 0, sizeof(m_counters));
+  memset(m_histograms, 0, sizeof(m_histograms));
+}
+
+void SIOStats::record(byte cmdClass, byte metric, unsigned long micros) {
+  // find the power-of-two bucket for the interval
+  byte bucket = 0;
+  micros >>= STAT_BUCKET_SHIFT;
+  while (micros && bucket < STAT_BUCKETS - 1) {
+    micros >>= 1;
+    bucket++;
+  }
+
+  // counts saturate rather than wrap
+  uint16_t *b = &m_histograms[cmdClass][metric][bucket];
+  if (*b < 0xFFFF) {
+    (*b)++;
+  }
+}
+
+void SIOStats::count(byte counter) {
+  if (m_counters[counter] < 0xFFFF) {
+    m_counters[counter]++;
+  }
+}
+
+/**
+ * Records when the current command started (the command line going low), which the
+ * command to ACK interval is measured from.
+ */
+void SIOStats::markCommandStart() {
+  m_commandStart = micros();
+}
+
+unsigned long SIOStats::getCommandStart() {
+  return m_commandStart;
+}
+
+unsigned int SIOStats::getFrameSize() {
+  return 4 + sizeof(m_counters) + sizeof(m_histograms);
+}
+
+/**
+ * Writes the statistics as an SIO data frame (without the checksum, which is returned).
+ * The frame starts with the table dimensions, followed by the counters and the histograms
+ * as little-endian 16-bit values ordered by class, then metric, then bucket.
+ */
+byte SIOStats::writeFrame(Stream* stream) {
+  int chkSum = 0;
+  byte dims[4] = {STAT_COUNTERS, STAT_CLASSES, STAT_METRICS, STAT_BUCKETS};
+
+  for (int i=0; i < 4; i++) {
+    stream->write(dims[i]);
+    chkSum = ((chkSum+dims[i])>>8) + ((chkSum+dims[i])&0xff);
+  }
+
+  byte* b = (byte*)m_counters;
+  for (unsigned int i=0; i < sizeof(m_counters); i++, b++) {
+    stream->write(*b);
+    chkSum = ((chkSum+*b)>>8) + ((chkSum+*b)&0xff);
+  }
+  b = (byte*)m_histograms;
+  for (unsigned int i=0; i < sizeof(m_histograms); i++, b++) {
+    stream->write(*b);
+    chkSum = ((chkSum+*b)>>8) + ((chkSum+*b)&0xff);
+  }
+
+  return (byte)chkSum;
+}
+
+void SIOStats::dump() {
+// we only compile this on DEBUG to save allocating string constants
+#ifdef DEBUG
+  LOG_MSG(F("NAK "));
+  LOG_MSG(m_counters[STAT_COUNT_NAK]);
+  LOG_MSG(F(", cmd checksum "));
+  LOG_MSG(m_counters[STAT_COUNT_CMD_CHECKSUM]);
+  LOG_MSG(F(", data checksum "));
+  LOG_MSG(m_counters[STAT_COUNT_DATA_CHECKSUM]);
+  LOG_MSG(F(", cmd timeout "));
+  LOG_MSG(m_counters[STAT_COUNT_CMD_TIMEOUT]);
+  LOG_MSG(F(", data timeout "));
+  LOG_MSG_CR(m_counters[STAT_COUNT_DATA_TIMEOUT]);
+
+  // one line per class/metric pair that has samples
+  for (byte c=0; c < STAT_CLASSES; c++) {
+    for (byte m=0; m < STAT_METRICS; m++) {
+      unsigned long total = 0;
+      for (byte b=0; b < STAT_BUCKETS; b++) {
+        total += m_histograms[c][m][b];
+      }
+      if (total) {
+        LOG_MSG(c);
+        LOG_MSG(F("/"));
+        LOG_MSG(m);
+        LOG_MSG(F(":"));
+        for (byte b=0; b < STAT_BUCKETS; b++) {
+          LOG_MSG(F(" "));
+          LOG_MSG(m_histograms[c][m][b]);
+        }
+        LOG_MSG_CR();
+      }
+    }
+  }
+#endif
+}
@@ -0,0 +1,51 @@
+#ifndef SIO_STATS_h
+#define SIO_STATS_h
+
+#include <Arduino.h>
+
+// command classes
+const byte STAT_CLASS_READ          = 0;
+const byte STAT_CLASS_WRITE         = 1;
+const byte STAT_CLASS_STATUS        = 2;
+const byte STAT_CLASS_OTHER         = 3;
+const byte STAT_CLASSES             = 4;
+
+// timed intervals
+const byte STAT_CMD_TO_ACK          = 0;
+const byte STAT_ACK_TO_COMPLETE     = 1;
+const byte STAT_SD_READ             = 2;
+const byte STAT_SD_WRITE            = 3;
+const byte STAT_DATA_TX             = 4;
+const byte STAT_METRICS             = 5;
+
+// bucket 0 holds intervals under 64us and each bucket after that doubles the
+// limit; the last bucket holds everything of 64ms or more
+const byte STAT_BUCKETS             = 12;
+const byte STAT_BUCKET_SHIFT        = 6;
+
+// event counters
+const byte STAT_COUNT_NAK           = 0;
+const byte STAT_COUNT_CMD_CHECKSUM  = 1;
+const byte STAT_COUNT_DATA_CHECKSUM = 2;
+const byte STAT_COUNT_CMD_TIMEOUT   = 3;
+const byte STAT_COUNT_DATA_TIMEOUT  = 4;
+const byte STAT_COUNTERS            = 5;
+
+class SIOStats {
+public:
+  SIOStats();
+  void reset();
+  void record(byte cmdClass, byte metric, unsigned long micros);
+  void count(byte counter);
+  void markCommandStart();
+  unsigned long getCommandStart();
+  unsigned int getFrameSize();
+  byte writeFrame(Stream* stream);
+  void dump();
+private:
+  uint16_t m_counters[STAT_COUNTERS];
+  uint16_t m_histograms[STAT_CLASSES][STAT_METRICS][STAT_BUCKETS];
+  unsigned long m_commandStart;
+};
+
+#endif
@@ -0,0 +1,83 @@
+/*
+ * sio_timing.cpp - SIO protocol timing profiles.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "sio_timing.h"
+#include "config.h"
+
+// gap lengths in microseconds (T2, T4, T5, data frame) for each profile
+const unsigned int TIMING_GAP_LENGTHS[TIMING_PROFILES][TIMING_GAPS] PROGMEM = {
+  { 1000, 1000, 1000, 700 },  // 810
+  {  500,  850,  500, 300 },  // 1050
+  {  100,  850,  250, 100 }   // fast
+};
+
+SIOTiming::SIOTiming() {
+  m_profile = TIMING_PROFILE;
+  m_mark = micros();
+  m_sendTime = 0;
+  setBaudRate(SIO_BAUD_RATE);
+}
+
+boolean SIOTiming::setProfile(byte profile) {
+  if (profile < TIMING_PROFILES) {
+    m_profile = profile;
+    return true;
+  }
+  return false;
+}
+
+byte SIOTiming::getProfile() {
+  return m_profile;
+}
+
+/**
+ * Sets the bus rate, which decides how long a byte we send takes to go out.
+ */
+void SIOTiming::setBaudRate(unsigned long baudRate) {
+  // a start bit, 8 data bits and a stop bit
+  m_byteTime = 10000000UL / baudRate;
+}
+
+/**
+ * Records the time the last part of the exchange happened.
+ */
+void SIOTiming::mark() {
+  m_mark = micros();
+  m_sendTime = 0;
+}
+
+unsigned long SIOTiming::sinceMark() {
+  return micros() - m_mark;
+}
+
+/**
+ * Waits until the given gap has passed since the last mark and then marks the current
+ * time. The caller sends a byte right after this, and that byte is only queued in the
+ * UART, so the next gap is measured from when it has been shifted out.
+ */
+void SIOTiming::waitFor(byte gap) {
+  unsigned int length = pgm_read_word(&TIMING_GAP_LENGTHS[m_profile][gap]) + m_sendTime;
+  while (micros() - m_mark < length) {
+  }
+  mark();
+  m_sendTime = m_byteTime;
+}
@@ -0,0 +1,41 @@
+#ifndef SIO_TIMING_h
+#define SIO_TIMING_h
+
+#include <Arduino.h>
+
+// timing profiles
+const byte TIMING_810               = 0;  // stock Atari 810 (the most conservative)
+const byte TIMING_1050              = 1;  // stock Atari 1050
+const byte TIMING_FAST              = 2;  // close to the SIO spec minimums (may not suit every OS)
+const byte TIMING_PROFILES          = 3;
+
+// protocol gaps
+const byte TIMING_T2                = 0;  // command line deasserted -> ACK
+const byte TIMING_T4                = 1;  // end of data frame -> ACK
+const byte TIMING_T5                = 2;  // ACK -> COMPLETE
+const byte TIMING_DATA              = 3;  // COMPLETE -> data frame
+const byte TIMING_GAPS              = 4;
+
+/**
+ * Enforces the minimum gaps between the parts of an SIO exchange. Each gap is measured
+ * from a timestamp taken when the previous part happened, so any time spent in between
+ * (e.g. reading the SD card) counts towards it rather than being added on top. A gap
+ * after a byte we've sent (an ACK or COMPLETE) starts once that byte is on the wire.
+ */
+class SIOTiming {
+public:
+  SIOTiming();
+  boolean setProfile(byte profile);
+  byte getProfile();
+  void setBaudRate(unsigned long baudRate);
+  void mark();
+  unsigned long sinceMark();
+  void waitFor(byte gap);
+private:
+  byte          m_profile;
+  unsigned long m_mark;
+  unsigned int  m_byteTime;
+  unsigned int  m_sendTime;
+};
+
+#endif
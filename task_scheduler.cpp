@@ -0,0 +1,68 @@
+/*
+ * task_scheduler.cpp - Runs background jobs between SIO commands.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "task_scheduler.h"
+#include "config.h"
+
+TaskScheduler::TaskScheduler(SIOChannel* channel) {
+  m_channel = channel;
+  m_taskCount = 0;
+}
+
+/**
+ * Adds a task (unless it's already scheduled). Returns false if there's no room.
+ */
+boolean TaskScheduler::schedule(TaskFunc task) {
+  if (isScheduled(task)) {
+    return true;
+  }
+  if (m_taskCount == MAX_TASKS) {
+    return false;
+  }
+  m_tasks[m_taskCount++] = task;
+  return true;
+}
+
+boolean TaskScheduler::isScheduled(TaskFunc task) {
+  for (byte i=0; i < m_taskCount; i++) {
+    if (m_tasks[i] == task) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Gives each task one slice, stopping as soon as the Atari starts a command.
+ */
+void TaskScheduler::run() {
+  byte i = 0;
+  while (i < m_taskCount && m_channel->isIdle()) {
+    if (m_tasks[i]()) {
+      // finished, so it's dropped (keeping the others in order)
+      m_taskCount--;
+      memmove(&m_tasks[i], &m_tasks[i + 1], (m_taskCount - i) * sizeof(TaskFunc));
+    } else {
+      i++;
+    }
+  }
+}
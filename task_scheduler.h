@@ -0,0 +1,30 @@
+#ifndef TASK_SCHEDULER_h
+#define TASK_SCHEDULER_h
+
+#include <Arduino.h>
+#include "sio_channel.h"
+
+const byte MAX_TASKS = 8;
+
+// a task does a small, bounded piece of its job each time it's called and returns true
+// once the whole job is finished
+typedef boolean (*TaskFunc)();
+
+/**
+ * Runs long jobs (directory scans, formats, display refreshes) a slice at a time from
+ * loop(). Slices only start while the SIO bus is idle, so a command arriving is never
+ * kept waiting by more than the slice that was already running.
+ */
+class TaskScheduler {
+public:
+  TaskScheduler(SIOChannel* channel);
+  boolean schedule(TaskFunc task);
+  boolean isScheduled(TaskFunc task);
+  void run();
+private:
+  SIOChannel*  m_channel;
+  TaskFunc     m_tasks[MAX_TASKS];
+  byte         m_taskCount;
+};
+
+#endif
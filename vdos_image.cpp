@@ -0,0 +1,177 @@
+/*
+ * vdos_image.cpp - Presents a directory as a read-only DOS 2 disk.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "vdos_image.h"
+
+#ifdef VDOS_IMAGES
+VDOSImage::~VDOSImage() {
+  if (m_file.isOpen()) {
+    m_file.close();
+  }
+}
+
+byte VDOSImage::getFileCount() {
+  return m_fileCount;
+}
+
+/**
+ * Builds the extent table for a virtual DOS disk. Files are laid out back to back
+ * starting at sector 4 (skipping the VTOC and directory) in directory order, so only
+ * each file's directory index and size need to be kept -- everything else is computed
+ * when a sector is read.
+ */
+boolean VDOSImage::load(SdFile *dir) {
+  m_dir = dir;
+  m_fileCount = 0;
+  m_usedSectors = 0;
+  m_openFile = VDOS_MAX_FILES;
+
+  dir->rewind();
+  while (m_fileCount < VDOS_MAX_FILES && m_file.openNext(dir, O_READ)) {
+    if (!m_file.isDir() && !m_file.isHidden()) {
+      VDOSFileEntry *entry = &m_files[m_fileCount];
+      entry->dirIndex = m_file.dirIndex();
+      entry->size = m_file.fileSize();
+
+      // skip anything that won't fit in what's left of the disk
+      unsigned int count = getSectorCount(m_fileCount);
+      if (m_usedSectors + count <= VDOS_DATA_SECTORS) {
+        m_usedSectors += count;
+        m_fileCount++;
+      }
+    }
+    m_file.close();
+  }
+
+  return true;
+}
+
+unsigned int VDOSImage::getSectorCount(byte file) {
+  unsigned long size = m_files[file].size;
+  // even an empty file takes up one sector
+  return (size == 0) ? 1 : (size + VDOS_BYTES_PER_SECTOR - 1) / VDOS_BYTES_PER_SECTOR;
+}
+
+// data sectors are 4-359 and 369-719
+static unsigned int vdosPhysicalSector(unsigned int logical) {
+  return (logical < VDOS_VTOC_SECTOR - 4) ? logical + 4 : logical + 4 + 1 + VDOS_DIR_SECTORS;
+}
+
+void VDOSImage::getSectorData(unsigned long sector, byte *data) {
+  memset(data, 0, SECTOR_SIZE_SD);
+
+  if (sector == VDOS_VTOC_SECTOR) {
+    getVTOC(data);
+  } else if (sector >= VDOS_DIR_SECTOR && sector < VDOS_DIR_SECTOR + VDOS_DIR_SECTORS) {
+    getDirSector(sector, data);
+  } else if (sector >= 4 && sector < VDOS_SECTOR_COUNT) {
+    getDataSector(sector, data);
+  }
+  // boot sectors (and anything else) are left blank -- the disk isn't bootable
+}
+
+void VDOSImage::getVTOC(byte *data) {
+  data[0] = 2; // DOS 2 VTOC
+  data[1] = VDOS_DATA_SECTORS & 0xFF;
+  data[2] = VDOS_DATA_SECTORS >> 8;
+  data[3] = (VDOS_DATA_SECTORS - m_usedSectors) & 0xFF;
+  data[4] = (VDOS_DATA_SECTORS - m_usedSectors) >> 8;
+
+  // mark every data sector past the last file as free
+  for (unsigned int l=m_usedSectors; l < VDOS_DATA_SECTORS; l++) {
+    unsigned int s = vdosPhysicalSector(l);
+    data[10 + s / 8] |= (0x80 >> (s % 8));
+  }
+}
+
+void VDOSImage::getDirSector(unsigned long sector, byte *data) {
+  byte first = (sector - VDOS_DIR_SECTOR) * 8;
+  unsigned int start = 0;
+
+  for (byte i=0; i < first && i < m_fileCount; i++) {
+    start += getSectorCount(i);
+  }
+
+  for (byte i=first; i < first + 8 && i < m_fileCount; i++) {
+    byte *entry = data + (i - first) * 16;
+    unsigned int count = getSectorCount(i);
+    unsigned int startSector = vdosPhysicalSector(start);
+
+    entry[0] = VDOS_FLAG_IN_USE | VDOS_FLAG_LOCKED;
+    entry[1] = count & 0xFF;
+    entry[2] = count >> 8;
+    entry[3] = startSector & 0xFF;
+    entry[4] = startSector >> 8;
+
+    // the FAT short name is already in the 8+3 space-padded form DOS 2 uses
+    m_dir->seekSet((unsigned long)m_files[i].dirIndex * sizeof(DirFat_t));
+    m_dir->read(entry + 5, 11);
+
+    start += count;
+  }
+}
+
+void VDOSImage::getDataSector(unsigned long sector, byte *data) {
+  unsigned int logical;
+  if (sector < VDOS_VTOC_SECTOR) {
+    logical = sector - 4;
+  } else if (sector > VDOS_DIR_SECTOR + VDOS_DIR_SECTORS - 1) {
+    logical = sector - 4 - 1 - VDOS_DIR_SECTORS;
+  } else {
+    return;
+  }
+
+  // find the file this sector belongs to
+  unsigned int start = 0;
+  for (byte i=0; i < m_fileCount; i++) {
+    unsigned int count = getSectorCount(i);
+    if (logical < start + count) {
+      unsigned long offset = (unsigned long)(logical - start) * VDOS_BYTES_PER_SECTOR;
+      byte len = 0;
+
+      if (offset < m_files[i].size) {
+        len = min(m_files[i].size - offset, VDOS_BYTES_PER_SECTOR);
+
+        // keep the last file we read open since reads are usually sequential
+        if (m_openFile != i) {
+          m_file.close();
+          if (!m_file.open(m_dir, m_files[i].dirIndex, O_READ)) {
+            m_openFile = VDOS_MAX_FILES;
+            return;
+          }
+          m_openFile = i;
+        }
+        m_file.seekSet(offset);
+        m_file.read(data, len);
+      }
+
+      // DOS 2 sector link: file number, next sector and byte count
+      unsigned int next = (logical + 1 < start + count) ? vdosPhysicalSector(logical + 1) : 0;
+      data[125] = (i << 2) | (next >> 8);
+      data[126] = next & 0xFF;
+      data[127] = len;
+      return;
+    }
+    start += count;
+  }
+}
+#endif
@@ -0,0 +1,46 @@
+#ifndef VDOS_IMAGE_h
+#define VDOS_IMAGE_h
+
+#include "image_format.h"
+
+#ifdef VDOS_IMAGES
+#define VDOS_SECTOR_COUNT     720
+#define VDOS_DATA_SECTORS     707
+#define VDOS_VTOC_SECTOR      360
+#define VDOS_DIR_SECTOR       361
+#define VDOS_DIR_SECTORS      8
+#define VDOS_MAX_FILES        64
+#define VDOS_BYTES_PER_SECTOR 125
+#define VDOS_FLAG_IN_USE      0x42
+#define VDOS_FLAG_LOCKED      0x20
+
+struct VDOSFileEntry {
+  unsigned int dirIndex;
+  unsigned long size;
+};
+
+/**
+ * A read-only DOS 2 disk synthesized from the files in a directory.
+ */
+class VDOSImage {
+public:
+  ~VDOSImage();
+  boolean load(SdFile* dir);
+  void getSectorData(unsigned long sector, byte* data);
+  byte getFileCount();
+private:
+  void getDirSector(unsigned long sector, byte* data);
+  void getVTOC(byte* data);
+  void getDataSector(unsigned long sector, byte* data);
+  unsigned int getSectorCount(byte file);
+
+  SdFile*          m_dir;
+  VDOSFileEntry    m_files[VDOS_MAX_FILES];
+  byte             m_fileCount;
+  unsigned int     m_usedSectors;
+  SdFile           m_file;
+  byte             m_openFile;
+};
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * xex_image.cpp - Serves XEX (binary load) files as bootable disks.
+ *
+ * Copyright (c) 2012 Whizzo Software LLC (Daniel Noguerol)
+ *
+ * This file is part of the SIO2Arduino project which emulates
+ * Atari 8-bit SIO devices on Arduino hardware.
+ *
+ * SIO2Arduino is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * SIO2Arduino is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with SIO2Arduino; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+#include "xex_image.h"
+
+#ifdef XEX_IMAGES
+// The KBoot loader was written by Ken Siders (atari@columbus.rr.com)
+// (kept in flash -- the file size is patched in on the fly when the boot sectors are read)
+#ifdef XEX_BURST_LOADER
+// A variant of KBoot whose read routine fills a 4 sector buffer at $0900 with one burst
+// read (0x72) instead of reading a sector at a time, and asks for no more sectors than
+// are left in the file. Sectors past 2047 can't be addressed by a burst, so in a bigger
+// file they're read one at a time with 0x52. It takes a fourth boot sector.
+const byte KBOOT_LOADER[] PROGMEM = {
+  0x00,0x04,0x00,0x07,0x14,0x07,0x4c,0x14,0x07,0xaa,0xbb,0x00,0x00,0xa9,0x46,0x8d,0xc6,0x02,0xd0,0xfe,0xa0,0x00,0xa9,0x6b,
+  0x91,0x58,0x20,0xd9,0x07,0xb0,0xee,0x20,0xc4,0x07,0xad,0xcd,0x08,0x0d,0xc9,0x08,0xd0,0xe3,0xa5,0x80,0x8d,0xe0,0x02,0xa5,
+  0x81,0x8d,0xe1,0x02,0xa9,0x00,0x8d,0xe2,0x02,0x8d,0xe3,0x02,0x20,0xf2,0x07,0xb0,0xcc,0xa0,0x00,0x91,0x80,0xa5,0x80,0xc5,
+  0x82,0xd0,0x06,0xa5,0x81,0xc5,0x83,0xf0,0x08,0xe6,0x80,0xd0,0x02,0xe6,0x81,0xd0,0xe3,0xad,0xc9,0x08,0xd0,0xaf,0xad,0xe2,
+  0x02,0x8d,0x70,0x07,0x0d,0xe3,0x02,0xf0,0x0e,0xad,0xe3,0x02,0x8d,0x71,0x07,0x20,0xff,0xff,0xad,0xcd,0x08,0xd0,0x13,0xa9,
+  0x00,0x8d,0xe2,0x02,0x8d,0xe3,0x02,0x20,0xae,0x07,0xad,0xcd,0x08,0xd0,0x03,0x4c,0x3c,0x07,0xa9,0x00,0x85,0x80,0x85,0x81,
+  0x85,0x82,0x85,0x83,0xad,0xe0,0x02,0x85,0x0a,0x85,0x0c,0xad,0xe1,0x02,0x85,0x0b,0x85,0x0d,0xa9,0x01,0x85,0x09,0xa9,0x00,
+  0x8d,0x44,0x02,0x6c,0xe0,0x02,0x20,0xf2,0x07,0x85,0x80,0x20,0xf2,0x07,0x85,0x81,0xa5,0x80,0xc9,0xff,0xd0,0x10,0xa5,0x81,
+  0xc9,0xff,0xd0,0x0a,0x20,0xf2,0x07,0x85,0x80,0x20,0xf2,0x07,0x85,0x81,0x20,0xf2,0x07,0x85,0x82,0x20,0xf2,0x07,0x85,0x83,
+  0x60,0x20,0xf2,0x07,0xc9,0xff,0xd0,0x09,0x20,0xf2,0x07,0xc9,0xff,0xd0,0x02,0x18,0x60,0x38,0x60,0xa0,0x01,0x8c,0xcd,0x08,
+  0x38,0x60,0xad,0x09,0x07,0x0d,0x0a,0x07,0x0d,0x0b,0x07,0xf0,0xee,0xac,0xcc,0x08,0x30,0x1d,0xb9,0x00,0x09,0xaa,0xad,0x09,
+  0x07,0xd0,0x0b,0xad,0x0a,0x07,0xd0,0x03,0xce,0x0b,0x07,0xce,0x0a,0x07,0xce,0x09,0x07,0xee,0xcc,0x08,0x8a,0x18,0x60,0xce,
+  0xce,0x08,0x30,0x14,0xad,0x03,0x08,0x49,0x80,0x8d,0x03,0x08,0x30,0x03,0xee,0x04,0x08,0xa0,0x00,0x8c,0xcc,0x08,0xf0,0xca,
+  0xa2,0x04,0xad,0x0b,0x07,0xd0,0x14,0xad,0x0a,0x07,0xc9,0x02,0xb0,0x0d,0x0a,0xaa,0xad,0x09,0x07,0xf0,0x06,0xe8,0xc9,0x81,
+  0x90,0x01,0xe8,0xa0,0x72,0xad,0xcb,0x08,0xc9,0x08,0x90,0x04,0xa2,0x01,0xa0,0x52,0x8c,0x02,0x03,0xa9,0x31,0x8d,0x00,0x03,
+  0xa9,0x01,0x8d,0x01,0x03,0xa9,0x40,0x8d,0x03,0x03,0xa9,0x00,0x8d,0x04,0x03,0x8d,0x03,0x08,0xa9,0x09,0x8d,0x05,0x03,0x8d,
+  0x04,0x08,0xa9,0x1f,0x8d,0x06,0x03,0x8a,0x4a,0x8d,0x09,0x03,0xa9,0x00,0x6a,0x8d,0x08,0x03,0xad,0xca,0x08,0x8d,0x0a,0x03,
+  0xca,0x8e,0xce,0x08,0x8a,0x0a,0x0a,0x0a,0x0d,0xcb,0x08,0x8d,0x0b,0x03,0x20,0x59,0xe4,0xad,0x03,0x03,0xc9,0x02,0xb0,0x12,
+  0x38,0xad,0xce,0x08,0x6d,0xca,0x08,0x8d,0xca,0x08,0x90,0x03,0xee,0xcb,0x08,0x4c,0x31,0x08,0xa0,0x01,0x8c,0xc9,0x08,0x38,
+  0x60,0x00,0x05,0x00,0x80,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+  0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,
+  0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00
+};
+#else
+const byte KBOOT_LOADER[] PROGMEM = {
+  0x00,0x03,0x00,0x07,0x14,0x07,0x4c,0x14,0x07,0xAA,0xBB,0x00,0x00,0xa9,0x46,0x8d,0xc6,0x02,0xd0,0xfe,0xa0,0x00,0xa9,0x6b,
+  0x91,0x58,0x20,0xd9,0x07,0xb0,0xee,0x20,0xc4,0x07,0xad,0x7a,0x08,0x0d,0x76,0x08,0xd0,0xe3,0xa5,0x80,0x8d,0xe0,0x02,0xa5,
+  0x81,0x8d,0xe1,0x02,0xa9,0x00,0x8d,0xe2,0x02,0x8d,0xe3,0x02,0x20,0xeb,0x07,0xb0,0xcc,0xa0,0x00,0x91,0x80,0xa5,0x80,0xc5,
+  0x82,0xd0,0x06,0xa5,0x81,0xc5,0x83,0xf0,0x08,0xe6,0x80,0xd0,0x02,0xe6,0x81,0xd0,0xe3,0xad,0x76,0x08,0xd0,0xaf,0xad,0xe2,
+  0x02,0x8d,0x70,0x07,0x0d,0xe3,0x02,0xf0,0x0e,0xad,0xe3,0x02,0x8d,0x71,0x07,0x20,0xff,0xff,0xad,0x7a,0x08,0xd0,0x13,0xa9,
+  0x00,0x8d,0xe2,0x02,0x8d,0xe3,0x02,0x20,0xae,0x07,0xad,0x7a,0x08,0xd0,0x03,0x4c,0x3c,0x07,0xa9,0x00,0x85,0x80,0x85,0x81,
+  0x85,0x82,0x85,0x83,0xad,0xe0,0x02,0x85,0x0a,0x85,0x0c,0xad,0xe1,0x02,0x85,0x0b,0x85,0x0d,0xa9,0x01,0x85,0x09,0xa9,0x00,
+  0x8d,0x44,0x02,0x6c,0xe0,0x02,0x20,0xeb,0x07,0x85,0x80,0x20,0xeb,0x07,0x85,0x81,0xa5,0x80,0xc9,0xff,0xd0,0x10,0xa5,0x81,
+  0xc9,0xff,0xd0,0x0a,0x20,0xeb,0x07,0x85,0x80,0x20,0xeb,0x07,0x85,0x81,0x20,0xeb,0x07,0x85,0x82,0x20,0xeb,0x07,0x85,0x83,
+  0x60,0x20,0xeb,0x07,0xc9,0xff,0xd0,0x09,0x20,0xeb,0x07,0xc9,0xff,0xd0,0x02,0x18,0x60,0x38,0x60,0xad,0x09,0x07,0x0d,0x0a,
+  0x07,0x0d,0x0b,0x07,0xf0,0x79,0xac,0x79,0x08,0x10,0x50,0xee,0x77,0x08,0xd0,0x03,0xee,0x78,0x08,0xa9,0x31,0x8d,0x00,0x03,
+  0xa9,0x01,0x8d,0x01,0x03,0xa9,0x52,0x8d,0x02,0x03,0xa9,0x40,0x8d,0x03,0x03,0xa9,0x80,0x8d,0x04,0x03,0xa9,0x08,0x8d,0x05,
+  0x03,0xa9,0x1f,0x8d,0x06,0x03,0xa9,0x80,0x8d,0x08,0x03,0xa9,0x00,0x8d,0x09,0x03,0xad,0x77,0x08,0x8d,0x0a,0x03,0xad,0x78,
+  0x08,0x8d,0x0b,0x03,0x20,0x59,0xe4,0xad,0x03,0x03,0xc9,0x02,0xb0,0x22,0xa0,0x00,0x8c,0x79,0x08,0xb9,0x80,0x08,0xaa,0xad,
+  0x09,0x07,0xd0,0x0b,0xad,0x0a,0x07,0xd0,0x03,0xce,0x0b,0x07,0xce,0x0a,0x07,0xce,0x09,0x07,0xee,0x79,0x08,0x8a,0x18,0x60,
+  0xa0,0x01,0x8c,0x76,0x08,0x38,0x60,0xa0,0x01,0x8c,0x7a,0x08,0x38,0x60,0x00,0x03,0x00,0x80,0x00,0x00,0x00,0x00,0x00,0x00
+};
+#endif
+
+/**
+ * Reads a sector: the loader (with the file size patched in) for the boot sectors, and
+ * the raw file after that.
+ */
+void XEXImage::getSectorData(SdFile* file, unsigned long sector, byte* data) {
+  if (sector <= KBOOT_SECTORS) {
+    unsigned long ix = (sector - 1) * SECTOR_SIZE_SD;
+    for (int i=0; i < SECTOR_SIZE_SD; i++, ix++) {
+      // the loader expects the 24-bit XEX file size at offsets 9-11
+      if (ix >= KBOOT_SIZE_OFFSET && ix < KBOOT_SIZE_OFFSET + 3) {
+        data[i] = (byte)(m_fileSize >> (8 * (ix - KBOOT_SIZE_OFFSET)));
+      } else {
+        data[i] = pgm_read_byte(&KBOOT_LOADER[ix]);
+      }
+    }
+  } else {
+    file->seekSet((sector - KBOOT_SECTORS - 1) * SECTOR_SIZE_SD);
+    readImageSector(file, data, SECTOR_SIZE_SD);
+  }
+}
+
+unsigned int XEXImage::getSegmentCount() {
+  return m_index.segmentCount;
+}
+
+unsigned int XEXImage::getRunAddress() {
+  return m_index.runAddress;
+}
+
+/**
+ * Checks that a file starts like an Atari binary load file. Its segments are walked by
+ * indexSegments().
+ */
+boolean XEXImage::load(SdFile *file, unsigned long fileSize) {
+  m_fileSize = fileSize;
+  memset(&m_index, 0, sizeof(m_index));
+
+  file->seekSet(0);
+  m_indexOffset = 2;
+  return (readWord(file) == 0xFFFF);
+}
+
+/**
+ * Walks the next few segments of an XEX file and records its load/INIT/RUN information.
+ * Fails if the file isn't a well-formed Atari binary load file.
+ */
+byte XEXImage::indexSegments(SdFile *file) {
+  unsigned long offset = m_indexOffset;
+  file->seekSet(offset);
+
+  for (byte n=0; n < XEX_INDEX_STEP_SEGMENTS; n++) {
+    if (offset + 4 > m_fileSize) {
+      // a few stray trailing bytes are harmless, but there has to be something to load
+      return (m_index.segmentCount > 0) ? INDEX_DONE : INDEX_FAILED;
+    }
+
+    unsigned int start = readWord(file);
+    offset += 2;
+
+    // the 0xFFFF marker is optional in front of every segment after the first
+    if (start == 0xFFFF) {
+      if (offset + 4 > m_fileSize) {
+        return (m_index.segmentCount > 0) ? INDEX_DONE : INDEX_FAILED;
+      }
+      start = readWord(file);
+      offset += 2;
+    }
+    unsigned int end = readWord(file);
+    offset += 2;
+
+    // reject inverted ranges and segments whose data runs past the end of the file
+    unsigned long length = (unsigned long)end - start + 1;
+    if (end < start || offset + length > m_fileSize) {
+      return INDEX_FAILED;
+    }
+
+    if (m_index.segmentCount == 0) {
+      m_index.firstLoadAddress = start;
+    }
+    m_index.segmentCount++;
+
+    // note any segment that writes the RUN (0x2E0) or INIT (0x2E2) vector
+    if (start <= XEX_RUNAD && end >= XEX_RUNAD + 1) {
+      file->seekSet(offset + XEX_RUNAD - start);
+      m_index.runAddress = readWord(file);
+    }
+    if (start <= XEX_INITAD && end >= XEX_INITAD + 1) {
+      m_index.initCount++;
+    }
+
+    offset += length;
+    file->seekSet(offset);
+  }
+
+  m_indexOffset = offset;
+  return INDEX_RUNNING;
+}
+
+unsigned int XEXImage::readWord(SdFile *file) {
+  unsigned int lo = (byte)file->read();
+  unsigned int hi = (byte)file->read();
+  return lo + (hi << 8);
+}
+#endif
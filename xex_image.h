@@ -0,0 +1,47 @@
+#ifndef XEX_IMAGE_h
+#define XEX_IMAGE_h
+
+#include "image_format.h"
+
+#ifdef XEX_IMAGES
+#define KBOOT_SIZE_OFFSET 9
+#ifdef XEX_BURST_LOADER
+#define KBOOT_SECTORS     4
+#else
+#define KBOOT_SECTORS     3
+#endif
+#define XEX_RUNAD         0x2E0
+#define XEX_INITAD        0x2E2
+
+// segments indexed per background step
+#define XEX_INDEX_STEP_SEGMENTS 8
+
+struct XEXSegmentIndex {
+  unsigned int segmentCount;
+  unsigned int initCount;
+  unsigned int firstLoadAddress;
+  unsigned int runAddress;
+};
+
+/**
+ * An XEX (binary load) file served as a disk: the KBoot loader in the boot sectors,
+ * followed by the file itself. The segments are indexed a few at a time by
+ * indexSegments().
+ */
+class XEXImage {
+public:
+  boolean load(SdFile* file, unsigned long fileSize);
+  byte indexSegments(SdFile* file);
+  void getSectorData(SdFile* file, unsigned long sector, byte* data);
+  unsigned int getSegmentCount();
+  unsigned int getRunAddress();
+private:
+  unsigned int readWord(SdFile* file);
+
+  unsigned long    m_fileSize;
+  unsigned long    m_indexOffset;
+  XEXSegmentIndex  m_index;
+};
+#endif
+
+#endif